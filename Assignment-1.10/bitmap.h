@@ -0,0 +1,142 @@
+#ifndef BITMAP_H
+# define BITMAP_H
+
+# include <stdint.h>
+# include <algorithm>
+
+/* A two-dimensional array of bits, for yes-or-no facts about map       *
+ * cells: one bit per cell, rows of 64-bit words, so an 80-wide row is  *
+ * two words and the whole default map is 336 bytes.  A row always      *
+ * starts on a word, so row(y) can be worked on a word at a time, and   *
+ * the bits past the width in a row's last word are unused.             *
+ *                                                                      *
+ * Like grid, it's built without optimization, so the accessors are     *
+ * forced inline.                                                       */
+class bitmap {
+ private:
+  uint64_t *words;
+  uint16_t w, h;
+  uint16_t stride;
+ public:
+  bitmap() : words(0), w(0), h(0), stride(0) {}
+  bitmap(uint16_t width, uint16_t height) : words(0), w(0), h(0), stride(0)
+  {
+    resize(width, height);
+  }
+  bitmap(const bitmap &o) : words(0), w(0), h(0), stride(0)
+  {
+    *this = o;
+  }
+  ~bitmap()
+  {
+    delete [] words;
+  }
+  bitmap &operator=(const bitmap &o)
+  {
+    if (this != &o) {
+      if (size() != o.size()) {
+        delete [] words;
+        words = new uint64_t[o.size()];
+      }
+      w = o.w;
+      h = o.h;
+      stride = o.stride;
+      std::copy(o.words, o.words + o.size(), words);
+    }
+    return *this;
+  }
+  /* Discards the contents; every bit becomes 0. */
+  void resize(uint16_t width, uint16_t height)
+  {
+    uint32_t words_needed;
+
+    words_needed = (uint32_t) ((width + 63) / 64) * height;
+    if (words_needed != size()) {
+      delete [] words;
+      words = new uint64_t[words_needed];
+    }
+    w = width;
+    h = height;
+    stride = (width + 63) / 64;
+    fill(0);
+  }
+  void fill(uint32_t value)
+  {
+    std::fill(words, words + size(), value ? ~0ULL : 0ULL);
+  }
+  inline uint16_t width() const
+  {
+    return w;
+  }
+  inline uint16_t height() const
+  {
+    return h;
+  }
+  /* In words, not bits. */
+  inline uint32_t size() const
+  {
+    return (uint32_t) stride * h;
+  }
+  inline uint16_t row_words() const
+  {
+    return stride;
+  }
+  inline uint64_t *row(int32_t y) __attribute__ ((always_inline))
+  {
+    return words + y * stride;
+  }
+  inline const uint64_t *row(int32_t y) const __attribute__ ((always_inline))
+  {
+    return words + y * stride;
+  }
+  inline uint32_t get(int32_t y, int32_t x) const
+    __attribute__ ((always_inline))
+  {
+    return (words[y * stride + (x >> 6)] >> (x & 63)) & 1;
+  }
+  inline void set(int32_t y, int32_t x, uint32_t value)
+    __attribute__ ((always_inline))
+  {
+    uint64_t *word = words + y * stride + (x >> 6);
+
+    *word = ((*word & ~(1ULL << (x & 63))) |
+             ((uint64_t) (value & 1) << (x & 63)));
+  }
+  /* The 3x3 block of bits around (y, x), which must not be on the   *
+   * edge, as a nine-bit number: bit 3 * (dy + 1) + (dx + 1) is the  *
+   * cell at (y + dy, x + dx).  Three shifts and masks rather than   *
+   * nine lookups.                                                   */
+  inline uint32_t neighborhood(int32_t y, int32_t x) const
+    __attribute__ ((always_inline))
+  {
+    return (bits3(y - 1, x - 1)       |
+            bits3(y,     x - 1) << 3  |
+            bits3(y + 1, x - 1) << 6);
+  }
+  bool operator==(const bitmap &o) const
+  {
+    return (w == o.w && h == o.h &&
+            std::equal(words, words + size(), o.words));
+  }
+  bool operator!=(const bitmap &o) const
+  {
+    return !(*this == o);
+  }
+ private:
+  /* Bits x, x + 1 and x + 2 of row y, which may straddle two words. */
+  inline uint32_t bits3(int32_t y, int32_t x) const
+    __attribute__ ((always_inline))
+  {
+    const uint64_t *word = words + y * stride + (x >> 6);
+    uint64_t v;
+
+    v = *word >> (x & 63);
+    if ((x & 63) > 61) {
+      v |= word[1] << (64 - (x & 63));
+    }
+
+    return v & 7;
+  }
+};
+
+#endif
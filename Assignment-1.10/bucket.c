@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "bucket.h"
+
+void bucket_queue_init(bucket_queue_t *q, uint32_t capacity,
+                       uint32_t max_cost)
+{
+  q->capacity = capacity;
+  q->num_buckets = max_cost + 1;
+
+  assert((q->bucket = malloc(q->num_buckets * sizeof (*q->bucket))));
+  assert((q->next = malloc(capacity * sizeof (*q->next))));
+  assert((q->prev = malloc(capacity * sizeof (*q->prev))));
+  assert((q->key = malloc(capacity * sizeof (*q->key))));
+
+  /* Everything starts out of the queue */
+  memset(q->key, 0xff, capacity * sizeof (*q->key));
+  memset(q->bucket, 0xff, q->num_buckets * sizeof (*q->bucket));
+  q->size = 0;
+  q->cursor = 0;
+}
+
+void bucket_queue_delete(bucket_queue_t *q)
+{
+  free(q->bucket);
+  free(q->next);
+  free(q->prev);
+  free(q->key);
+  memset(q, 0, sizeof (*q));
+}
+
+void bucket_queue_reset(bucket_queue_t *q)
+{
+  uint32_t b, i;
+
+  /* Only elements still in the queue have keys to clear, so this is *
+   * free after the queue has been drained.                          */
+  for (b = 0; q->size && b < q->num_buckets; b++) {
+    for (i = q->bucket[b]; i != BUCKET_QUEUE_NONE; i = q->next[i]) {
+      q->key[i] = BUCKET_QUEUE_NONE;
+    }
+  }
+  memset(q->bucket, 0xff, q->num_buckets * sizeof (*q->bucket));
+  q->size = 0;
+  q->cursor = 0;
+}
+
+static void bucket_link(bucket_queue_t *q, uint32_t i)
+{
+  uint32_t b;
+
+  b = q->key[i] % q->num_buckets;
+  q->prev[i] = BUCKET_QUEUE_NONE;
+  q->next[i] = q->bucket[b];
+  if (q->bucket[b] != BUCKET_QUEUE_NONE) {
+    q->prev[q->bucket[b]] = i;
+  }
+  q->bucket[b] = i;
+}
+
+static void bucket_unlink(bucket_queue_t *q, uint32_t i)
+{
+  if (q->prev[i] != BUCKET_QUEUE_NONE) {
+    q->next[q->prev[i]] = q->next[i];
+  } else {
+    q->bucket[q->key[i] % q->num_buckets] = q->next[i];
+  }
+  if (q->next[i] != BUCKET_QUEUE_NONE) {
+    q->prev[q->next[i]] = q->prev[i];
+  }
+}
+
+void bucket_queue_insert(bucket_queue_t *q, uint32_t i, uint32_t key)
+{
+  assert(!bucket_queue_contains(q, i));
+  assert(!q->size ||
+         (key >= q->cursor && key - q->cursor < q->num_buckets));
+
+  if (!q->size) {
+    q->cursor = key;
+  }
+  q->key[i] = key;
+  bucket_link(q, i);
+  q->size++;
+}
+
+void bucket_queue_decrease_key(bucket_queue_t *q, uint32_t i, uint32_t key)
+{
+  assert(bucket_queue_contains(q, i));
+  assert(key >= q->cursor && key <= q->key[i]);
+
+  bucket_unlink(q, i);
+  q->key[i] = key;
+  bucket_link(q, i);
+}
+
+uint32_t bucket_queue_remove_min(bucket_queue_t *q)
+{
+  uint32_t i;
+
+  if (!q->size) {
+    return BUCKET_QUEUE_NONE;
+  }
+
+  /* All keys lie in [cursor, cursor + max_cost], so this loop looks *
+   * at no more than num_buckets buckets.                            */
+  while ((i = q->bucket[q->cursor % q->num_buckets]) == BUCKET_QUEUE_NONE) {
+    q->cursor++;
+  }
+
+  bucket_unlink(q, i);
+  q->key[i] = BUCKET_QUEUE_NONE;
+  q->size--;
+
+  return i;
+}
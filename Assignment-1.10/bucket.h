@@ -0,0 +1,47 @@
+#ifndef BUCKET_H
+# define BUCKET_H
+
+# ifdef __cplusplus
+extern "C" {
+# endif
+
+# include <stdint.h>
+
+/* A monotone bucket queue (Dial's algorithm) for small integer keys.   *
+ * Elements are identified by an index in [0, capacity), and every key  *
+ * in the queue must lie within max_cost of the most recently removed   *
+ * minimum, which is exactly what Dijkstra's algorithm guarantees when  *
+ * edge costs are integers no larger than max_cost.  Under those rules, *
+ * insert, decrease key and remove min are all O(1) amortized.          */
+
+# define BUCKET_QUEUE_NONE UINT32_MAX
+
+typedef struct bucket_queue {
+  uint32_t capacity;
+  uint32_t num_buckets;
+  uint32_t size;
+  uint32_t cursor;
+  uint32_t *bucket;
+  uint32_t *next;
+  uint32_t *prev;
+  uint32_t *key;
+} bucket_queue_t;
+
+void bucket_queue_init(bucket_queue_t *q, uint32_t capacity,
+                       uint32_t max_cost);
+void bucket_queue_delete(bucket_queue_t *q);
+void bucket_queue_reset(bucket_queue_t *q);
+void bucket_queue_insert(bucket_queue_t *q, uint32_t i, uint32_t key);
+void bucket_queue_decrease_key(bucket_queue_t *q, uint32_t i, uint32_t key);
+uint32_t bucket_queue_remove_min(bucket_queue_t *q);
+
+static inline int bucket_queue_contains(const bucket_queue_t *q, uint32_t i)
+{
+  return q->key[i] != BUCKET_QUEUE_NONE;
+}
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif
@@ -81,8 +81,8 @@ const char *character_get_name(const character *c)
   return c->name;
 }
 
-uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
-                 int is_pc, int learn)
+static uint32_t can_see_walk(dungeon *d, pair_t voyeur, pair_t exhibitionist,
+                             int is_pc, int learn)
 {
   /* Application of Bresenham's Line Drawing Algorithm.  If we can draw *
    * a line from v to e without intersecting any walls, then v can see  *
@@ -111,6 +111,8 @@ uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
     return 0;
   }
 
+  terrain_layers_update(d);
+
   /*
   mappair(first) = ter_debug;
   mappair(second) = ter_debug;
@@ -141,7 +143,7 @@ uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
         pc_learn_terrain(d->PC, first, mappair(first));
         pc_see_object(d->PC, objpair(first));
       }
-      if ((mappair(first) < ter_floor) && i && (i != del[dim_x])) {
+      if (!walkablepair(first) && i && (i != del[dim_x])) {
         return 0;
       }
       /*      mappair(first) = ter_debug;*/
@@ -163,7 +165,7 @@ uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
         pc_learn_terrain(d->PC, first, mappair(first));
         pc_see_object(d->PC, objpair(first));
       }
-      if ((mappair(first) < ter_floor) && i && (i != del[dim_y])) {
+      if (!walkablepair(first) && i && (i != del[dim_y])) {
         return 0;
       }
       /*      mappair(first) = ter_debug;*/
@@ -180,3 +182,60 @@ uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
 
   return 1;
 }
+
+/* Nearly every line of sight drawn is to or from the PC: the PC looking *
+ * at a cell (is_pc), or a monster looking for the PC (!is_pc).  Those   *
+ * answers only depend on the other end of the line while the PC stands  *
+ * still and the terrain doesn't change, so each is remembered in a bit  *
+ * per cell, and the bits are thrown out--a word at a time--when either  *
+ * one moves.  Anything else, and anything that teaches the PC terrain,  *
+ * walks the line.                                                       */
+uint32_t can_see(dungeon *d, pair_t voyeur, pair_t exhibitionist,
+                 int is_pc, int learn)
+{
+  int16_t *other;
+  uint32_t seen;
+
+  /* Plans made in parallel (npc_plan_moves()) can only read. */
+  if (d->planning) {
+    return can_see_walk(d, voyeur, exhibitionist, is_pc, learn);
+  }
+
+  d->los_queries++;
+
+  if (learn || !d->PC) {
+    d->los_walks++;
+    return can_see_walk(d, voyeur, exhibitionist, is_pc, learn);
+  }
+  if (is_pc && voyeur[dim_y] == d->PC->position[dim_y] &&
+      voyeur[dim_x] == d->PC->position[dim_x]) {
+    other = exhibitionist;
+  } else if (!is_pc && exhibitionist[dim_y] == d->PC->position[dim_y] &&
+             exhibitionist[dim_x] == d->PC->position[dim_x]) {
+    other = voyeur;
+  } else {
+    d->los_walks++;
+    return can_see_walk(d, voyeur, exhibitionist, is_pc, learn);
+  }
+
+  if (d->los_position[dim_y] != d->PC->position[dim_y] ||
+      d->los_position[dim_x] != d->PC->position[dim_x] ||
+      d->los_terrain_generation != d->terrain_generation) {
+    d->los_known[0].fill(0);
+    d->los_known[1].fill(0);
+    d->los_position[dim_y] = d->PC->position[dim_y];
+    d->los_position[dim_x] = d->PC->position[dim_x];
+    d->los_terrain_generation = d->terrain_generation;
+  }
+
+  if (d->los_known[is_pc].get(other[dim_y], other[dim_x])) {
+    return d->los_seen[is_pc].get(other[dim_y], other[dim_x]);
+  }
+
+  d->los_walks++;
+  seen = can_see_walk(d, voyeur, exhibitionist, is_pc, learn);
+  d->los_known[is_pc].set(other[dim_y], other[dim_x], 1);
+  d->los_seen[is_pc].set(other[dim_y], other[dim_x], seen);
+
+  return seen;
+}
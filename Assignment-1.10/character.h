@@ -7,6 +7,7 @@
 
 #include "dims.h"
 #include "utils.h"
+#include "rng.h"
 
 typedef enum kill_type
 {
@@ -38,7 +39,14 @@ public:
    * characters have been created by the game.                              */
   uint32_t sequence_number;
   uint32_t kills[num_kill_types];
-  inline uint32_t get_color() { return color[rand_range(0, color.size() - 1)]; }
+  /* Multicolored monsters flicker.  Which color gets drawn is cosmetic, *
+   * so it comes from a generator of its own, not one of the dungeon's.  */
+  inline uint32_t get_color()
+  {
+    static rng flicker;
+
+    return color[flicker.under(color.size())];
+  }
   inline char get_symbol() { return symbol; }
 };
 
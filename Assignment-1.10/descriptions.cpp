@@ -1070,15 +1070,15 @@ npc *monster_description::generate_monster(dungeon *d)
   std::vector<monster_description> &v = d->monster_descriptions;
   uint32_t i;
 
-  while (!v[(i = (rand() % v.size()))].can_be_generated() ||
-         !v[i].pass_rarity_roll())
+  while (!v[(i = d->map_rng.under(v.size()))].can_be_generated() ||
+         !v[i].pass_rarity_roll(d->map_rng))
     ;
 
   monster_description &m = v[i];
 
   n = new npc(d, m);
 
-  heap_insert(&d->events, new_event(d, event_character_turn, n, 0));
+  event_queue_insert(&d->events, new_event(d, event_character_turn, n, 0));
 
   return n;
 }
@@ -54,9 +54,9 @@ class monster_description {
     return (((abilities & NPC_UNIQ) && !num_alive && !num_killed) ||
             !(abilities & NPC_UNIQ));
   }
-  inline bool pass_rarity_roll()
+  inline bool pass_rarity_roll(rng &r)
   {
-    return rarity > (unsigned) (rand() % 100);
+    return rarity > r.under(100);
   }
 
 public:
@@ -117,9 +117,9 @@ class object_description {
   {
     return !artifact || (artifact && !num_generated && !num_found);
   }
-  inline bool pass_rarity_roll()
+  inline bool pass_rarity_roll(rng &r)
   {
-    return rarity > (unsigned) (rand() % 100);
+    return rarity > r.under(100);
   }
   void set(const std::string &name,
            const std::string &description,
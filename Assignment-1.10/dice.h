@@ -4,6 +4,8 @@
 # include <stdint.h>
 # include <iostream>
 
+# include "rng.h"
+
 class dice {
  private:
   int32_t base;
@@ -34,7 +36,7 @@ class dice {
   {
     this->sides = sides;
   }
-  int32_t roll(void) const;
+  int32_t roll(rng &r) const;
   std::ostream &print(std::ostream &o);
   inline int32_t get_base() const
   {
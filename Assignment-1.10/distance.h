@@ -0,0 +1,100 @@
+#ifndef DISTANCE_H
+# define DISTANCE_H
+
+# include <stdint.h>
+
+# include "grid.h"
+
+/* A map of path lengths from the PC, stored in the narrowest unsigned *
+ * type that can hold the longest path the dungeon allows.  The        *
+ * largest value of that type, infinity(), means unreachable.  The     *
+ * default dungeon keeps its one-byte cells; bigger ones get two or    *
+ * four bytes, so distances never saturate.                            *
+ *                                                                     *
+ * Pathfinding is templated on the cell type and gets at the typed     *
+ * grid with cells<T>() once per search, switching on bytes().  The    *
+ * occasional reader that only wants one value can use get(), which    *
+ * switches on every call.                                             */
+class distance_map {
+ private:
+  grid<uint8_t> d8;
+  grid<uint16_t> d16;
+  grid<uint32_t> d32;
+  uint32_t cell_bytes;
+ public:
+  distance_map() : cell_bytes(1) {}
+  distance_map(uint16_t width, uint16_t height) :
+    d8(width, height), cell_bytes(1) {}
+  /* Cells are just wide enough that max_distance isn't infinity. */
+  void resize(uint16_t width, uint16_t height, uint32_t max_distance)
+  {
+    d8.resize(0, 0);
+    d16.resize(0, 0);
+    d32.resize(0, 0);
+    if (max_distance < UINT8_MAX) {
+      cell_bytes = 1;
+      d8.resize(width, height);
+    } else if (max_distance < UINT16_MAX) {
+      cell_bytes = 2;
+      d16.resize(width, height);
+    } else {
+      cell_bytes = 4;
+      d32.resize(width, height);
+    }
+  }
+  void swap(distance_map &o)
+  {
+    d8.swap(o.d8);
+    d16.swap(o.d16);
+    d32.swap(o.d32);
+    std::swap(cell_bytes, o.cell_bytes);
+  }
+  inline uint32_t bytes() const
+  {
+    return cell_bytes;
+  }
+  inline uint32_t infinity() const
+  {
+    return (cell_bytes == 1 ? UINT8_MAX :
+            cell_bytes == 2 ? UINT16_MAX : UINT32_MAX);
+  }
+  inline uint32_t size() const
+  {
+    return d8.size() + d16.size() + d32.size();
+  }
+  inline uint32_t get(int32_t y, int32_t x) const
+  {
+    return (cell_bytes == 1 ? d8[y][x] :
+            cell_bytes == 2 ? d16[y][x] : d32[y][x]);
+  }
+  template <class T> grid<T> &cells();
+  bool operator==(const distance_map &o) const
+  {
+    return (cell_bytes == o.cell_bytes &&
+            d8 == o.d8 && d16 == o.d16 && d32 == o.d32);
+  }
+  bool operator!=(const distance_map &o) const
+  {
+    return !(*this == o);
+  }
+};
+
+template <>
+inline grid<uint8_t> &distance_map::cells<uint8_t>()
+{
+  return d8;
+}
+
+template <>
+inline grid<uint16_t> &distance_map::cells<uint16_t>()
+{
+  return d16;
+}
+
+template <>
+inline grid<uint32_t> &distance_map::cells<uint32_t>()
+{
+  return d32;
+}
+
+#endif
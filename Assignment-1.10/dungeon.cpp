@@ -18,16 +18,37 @@
 #include "npc.h"
 #include "io.h"
 #include "object.h"
+#include "path.h"
+#include "work_pool.h"
 
 #define DUMP_HARDNESS_IMAGES 0
+#define ROOM_PLACEMENT_ATTEMPTS 100
+#define CORRIDOR_MARGIN 8
 
 typedef struct corridor_path {
   heap_node_t *hn;
-  uint8_t pos[2];
-  uint8_t from[2];
+  pair_t pos;
+  pair_t from;
   int32_t cost;
+  uint32_t search;
 } corridor_path_t;
 
+/* Scratch space for the corridor searches, shared by every corridor  *
+ * in one dungeon.  A cell belongs to the current search only if its  *
+ * search number matches; anything else is untouched, so nothing has  *
+ * to be cleared between corridors.  Owned by connect_rooms(), not    *
+ * static, so that several dungeons can be generated at once.         *
+ *                                                                    *
+ * Searches stay inside [lo, hi].  Open space costs nothing to cross, *
+ * so once a big dungeon has a few corridors, an unbounded search     *
+ * floods every one of them before it can afford to dig.              */
+typedef struct corridor_scratch {
+  grid<corridor_path_t> path;
+  heap_pool_t *pool;
+  uint32_t search;
+  pair_t lo, hi;
+} corridor_scratch_t;
+
 /*
 static uint32_t in_room(dungeon *d, int16_t y, int16_t x)
 {
@@ -63,141 +84,93 @@ static int32_t corridor_path_cmp(const void *key, const void *with) {
   return ((corridor_path_t *) key)->cost - ((corridor_path_t *) with)->cost;
 }
 
-static void dijkstra_corridor(dungeon *d, pair_t from, pair_t to)
+#define hardnesspair_inv(p) (is_open_space(d, p[dim_y], p[dim_x]) ? 127 :     \
+                             (adjacent_to_room(d, p[dim_y], p[dim_x]) ? 191 : \
+                              (255 - hardnesspair(p))))
+
+/* Offers the neighbor of p at (dy, dx) a path through p.  Cells enter *
+ * the heap the first time they're reached rather than all up front,   *
+ * so a search only ever touches the cells nearer the source than the  *
+ * destination, not the whole dungeon.                                 */
+static void corridor_relax(dungeon *d, corridor_scratch_t *s, heap_t *h,
+                           corridor_path_t *p, int32_t dy, int32_t dx,
+                           int32_t cost)
 {
-  static corridor_path_t path[DUNGEON_Y][DUNGEON_X], *p;
-  static uint32_t initialized = 0;
-  heap_t h;
-  int32_t x, y;
+  corridor_path_t *n;
 
-  if (!initialized) {
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
-        path[y][x].pos[dim_y] = y;
-        path[y][x].pos[dim_x] = x;
-      }
-    }
-    initialized = 1;
+  if (p->pos[dim_y] + dy < s->lo[dim_y] || p->pos[dim_y] + dy > s->hi[dim_y] ||
+      p->pos[dim_x] + dx < s->lo[dim_x] || p->pos[dim_x] + dx > s->hi[dim_x]) {
+    return;
   }
-  
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      path[y][x].cost = INT_MAX;
-    }
-  }
-
-  path[from[dim_y]][from[dim_x]].cost = 0;
 
-  heap_init(&h, corridor_path_cmp, NULL);
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      if (mapxy(x, y) != ter_wall_immutable) {
-        path[y][x].hn = heap_insert(&h, &path[y][x]);
-      } else {
-        path[y][x].hn = NULL;
-      }
-    }
-  }
-
-  while ((p = (corridor_path_t *) heap_remove_min(&h))) {
-    p->hn = NULL;
-
-    if ((p->pos[dim_y] == to[dim_y]) && p->pos[dim_x] == to[dim_x]) {
-      for (x = to[dim_x], y = to[dim_y];
-           (x != from[dim_x]) || (y != from[dim_y]);
-           p = &path[y][x], x = p->from[dim_x], y = p->from[dim_y]) {
-        if (mapxy(x, y) != ter_floor_room) {
-          mapxy(x, y) = ter_floor_hall;
-          hardnessxy(x, y) = 0;
-        }
-      }
-      heap_delete(&h);
+  n = &s->path[p->pos[dim_y] + dy][p->pos[dim_x] + dx];
+  if (n->search != s->search) {
+    n->search = s->search;
+    n->pos[dim_y] = p->pos[dim_y] + dy;
+    n->pos[dim_x] = p->pos[dim_x] + dx;
+    n->hn = NULL;
+    if (mappair(n->pos) == ter_wall_immutable) {
+      /* Never in the heap, so it looks already settled. */
       return;
     }
+  } else if (!n->hn || n->cost <= cost) {
+    return;
+  }
 
-    if ((path[p->pos[dim_y] - 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] - 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] - 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] - 1].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] + 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] + 1].hn);
-    }
-    if ((path[p->pos[dim_y] + 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] + 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
+  n->cost = cost;
+  n->from[dim_y] = p->pos[dim_y];
+  n->from[dim_x] = p->pos[dim_x];
+  if (n->hn) {
+    heap_decrease_key_no_replace(h, n->hn);
+  } else {
+    n->hn = heap_insert(h, n);
   }
 }
 
-/* This is a cut-and-paste of the above.  The code is modified to  *
- * calculate paths based on inverse hardnesses so that we get a    *
- * high probability of creating at least one cycle in the dungeon. */
-static void dijkstra_corridor_inv(dungeon *d, pair_t from, pair_t to)
+/* Digs the cheapest corridor from from to to.  The cost of leaving a *
+ * cell is its hardness, or with inverse set, roughly the opposite,   *
+ * which makes for a high probability of creating at least one cycle  *
+ * in the dungeon.                                                    */
+static void dijkstra_corridor(dungeon *d, corridor_scratch_t *s,
+                              pair_t from, pair_t to, uint32_t inverse)
 {
-  static corridor_path_t path[DUNGEON_Y][DUNGEON_X], *p;
-  static uint32_t initialized = 0;
+  corridor_path_t *p;
   heap_t h;
-  int32_t x, y;
-
-  if (!initialized) {
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
-        path[y][x].pos[dim_y] = y;
-        path[y][x].pos[dim_x] = x;
+  int32_t x, y, cost, size[num_dims];
+  uint32_t dim;
+
+  s->search++;
+
+  /* Rooms in a default-sized dungeon may go the long way around; in *
+   * a bigger one, corridors stay near the box around their ends.    */
+  size[dim_x] = d->width;
+  size[dim_y] = d->height;
+  for (dim = 0; dim < num_dims; dim++) {
+    if (d->num_rooms > MAX_ROOMS) {
+      s->lo[dim] = ((from[dim] < to[dim] ? from[dim] : to[dim]) -
+                    CORRIDOR_MARGIN);
+      s->hi[dim] = ((from[dim] > to[dim] ? from[dim] : to[dim]) +
+                    CORRIDOR_MARGIN);
+      if (s->lo[dim] < 1) {
+        s->lo[dim] = 1;
       }
-    }
-    initialized = 1;
-  }
-  
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      path[y][x].cost = INT_MAX;
+      if (s->hi[dim] > size[dim] - 2) {
+        s->hi[dim] = size[dim] - 2;
+      }
+    } else {
+      s->lo[dim] = 0;
+      s->hi[dim] = size[dim] - 1;
     }
   }
 
-  path[from[dim_y]][from[dim_x]].cost = 0;
-
-  heap_init(&h, corridor_path_cmp, NULL);
+  heap_init_pooled(&h, corridor_path_cmp, NULL, s->pool);
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      if (mapxy(x, y) != ter_wall_immutable) {
-        path[y][x].hn = heap_insert(&h, &path[y][x]);
-      } else {
-        path[y][x].hn = NULL;
-      }
-    }
-  }
+  p = &s->path[from[dim_y]][from[dim_x]];
+  p->search = s->search;
+  p->pos[dim_y] = from[dim_y];
+  p->pos[dim_x] = from[dim_x];
+  p->cost = 0;
+  p->hn = heap_insert(&h, p);
 
   while ((p = (corridor_path_t *) heap_remove_min(&h))) {
     p->hn = NULL;
@@ -205,86 +178,50 @@ static void dijkstra_corridor_inv(dungeon *d, pair_t from, pair_t to)
     if ((p->pos[dim_y] == to[dim_y]) && p->pos[dim_x] == to[dim_x]) {
       for (x = to[dim_x], y = to[dim_y];
            (x != from[dim_x]) || (y != from[dim_y]);
-           p = &path[y][x], x = p->from[dim_x], y = p->from[dim_y]) {
+           p = &s->path[y][x], x = p->from[dim_x], y = p->from[dim_y]) {
         if (mapxy(x, y) != ter_floor_room) {
           mapxy(x, y) = ter_floor_hall;
           hardnessxy(x, y) = 0;
         }
       }
-      heap_delete(&h);
-      return;
+      break;
     }
 
-#define hardnesspair_inv(p) (is_open_space(d, p[dim_y], p[dim_x]) ? 127 :     \
-                             (adjacent_to_room(d, p[dim_y], p[dim_x]) ? 191 : \
-                              (255 - hardnesspair(p))))
-
-    if ((path[p->pos[dim_y] - 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] - 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] - 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] - 1].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] + 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] + 1].hn);
-    }
-    if ((path[p->pos[dim_y] + 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] + 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
+    cost = p->cost + (inverse ? hardnesspair_inv(p->pos) :
+                                hardnesspair(p->pos));
+    corridor_relax(d, s, &h, p, -1,  0, cost);
+    corridor_relax(d, s, &h, p,  0, -1, cost);
+    corridor_relax(d, s, &h, p,  0,  1, cost);
+    corridor_relax(d, s, &h, p,  1,  0, cost);
   }
+
+  heap_delete(&h);
 }
 
 /* Chooses a random point inside each room and connects them with a *
  * corridor.  Random internal points prevent corridors from exiting *
  * rooms in predictable locations.                                  */
-static int connect_two_rooms(dungeon *d, room_t *r1, room_t *r2)
+static int connect_two_rooms(dungeon *d, corridor_scratch_t *s,
+                             room_t *r1, room_t *r2)
 {
   pair_t e1, e2;
 
-  e1[dim_y] = rand_range(r1->position[dim_y],
-                         r1->position[dim_y] + r1->size[dim_y] - 1);
-  e1[dim_x] = rand_range(r1->position[dim_x],
-                         r1->position[dim_x] + r1->size[dim_x] - 1);
-  e2[dim_y] = rand_range(r2->position[dim_y],
-                         r2->position[dim_y] + r2->size[dim_y] - 1);
-  e2[dim_x] = rand_range(r2->position[dim_x],
-                         r2->position[dim_x] + r2->size[dim_x] - 1);
+  e1[dim_y] = d->map_rng.range(r1->position[dim_y],
+                               r1->position[dim_y] + r1->size[dim_y] - 1);
+  e1[dim_x] = d->map_rng.range(r1->position[dim_x],
+                               r1->position[dim_x] + r1->size[dim_x] - 1);
+  e2[dim_y] = d->map_rng.range(r2->position[dim_y],
+                               r2->position[dim_y] + r2->size[dim_y] - 1);
+  e2[dim_x] = d->map_rng.range(r2->position[dim_x],
+                               r2->position[dim_x] + r2->size[dim_x] - 1);
 
   /*  return connect_two_points_recursive(d, e1, e2);*/
-  dijkstra_corridor(d, e1, e2);
+  dijkstra_corridor(d, s, e1, e2, 0);
 
   return 0;
 }
 
-static int create_cycle(dungeon *d)
+static int create_cycle(dungeon *d, corridor_scratch_t *s)
 {
   /* Find the (approximately) farthest two rooms, then connect *
    * them by the shortest path using inverted hardnesses.      */
@@ -308,38 +245,71 @@ static int create_cycle(dungeon *d)
 
   /* Can't simply call connect_two_rooms() because it doesn't *
    * use inverse hardnesses, so duplicate it here.            */
-  e1[dim_y] = rand_range(d->rooms[p].position[dim_y],
-                         (d->rooms[p].position[dim_y] +
-                          d->rooms[p].size[dim_y] - 1));
-  e1[dim_x] = rand_range(d->rooms[p].position[dim_x],
-                         (d->rooms[p].position[dim_x] +
-                          d->rooms[p].size[dim_x] - 1));
-  e2[dim_y] = rand_range(d->rooms[q].position[dim_y],
-                         (d->rooms[q].position[dim_y] +
-                          d->rooms[q].size[dim_y] - 1));
-  e2[dim_x] = rand_range(d->rooms[q].position[dim_x],
-                         (d->rooms[q].position[dim_x] +
-                          d->rooms[q].size[dim_x] - 1));
-
-  dijkstra_corridor_inv(d, e1, e2);
+  e1[dim_y] = d->map_rng.range(d->rooms[p].position[dim_y],
+                               (d->rooms[p].position[dim_y] +
+                                d->rooms[p].size[dim_y] - 1));
+  e1[dim_x] = d->map_rng.range(d->rooms[p].position[dim_x],
+                               (d->rooms[p].position[dim_x] +
+                                d->rooms[p].size[dim_x] - 1));
+  e2[dim_y] = d->map_rng.range(d->rooms[q].position[dim_y],
+                               (d->rooms[q].position[dim_y] +
+                                d->rooms[q].size[dim_y] - 1));
+  e2[dim_x] = d->map_rng.range(d->rooms[q].position[dim_x],
+                               (d->rooms[q].position[dim_x] +
+                                d->rooms[q].size[dim_x] - 1));
+
+  dijkstra_corridor(d, s, e1, e2, 1);
 
   return 0;
 }
 
+/* Orders rooms a default dungeon's height at a time, top to bottom, *
+ * left to right in even bands and right to left in odd ones.        */
+static int room_band_cmp(const void *v1, const void *v2)
+{
+  const room_t *r1 = (const room_t *) v1;
+  const room_t *r2 = (const room_t *) v2;
+  int32_t b1, b2;
+
+  b1 = r1->position[dim_y] / DUNGEON_Y;
+  b2 = r2->position[dim_y] / DUNGEON_Y;
+  if (b1 != b2) {
+    return b1 - b2;
+  }
+
+  return ((b1 & 1) ? r2->position[dim_x] - r1->position[dim_x] :
+                     r1->position[dim_x] - r2->position[dim_x]);
+}
+
 static int connect_rooms(dungeon *d)
 {
+  corridor_scratch_t s;
   uint32_t i;
 
+  s.path.resize(d->width, d->height);
+  s.pool = heap_pool_new(1024);
+  s.search = 0;
+
+  /* Rooms are placed in random order, which is fine when they're all *
+   * within one screen of each other.  In a bigger dungeon, chaining  *
+   * them in that order would run every corridor across the whole     *
+   * map, so snake through them a band at a time instead.             */
+  if (d->num_rooms > MAX_ROOMS) {
+    qsort(d->rooms, d->num_rooms, sizeof (*d->rooms), room_band_cmp);
+  }
+
   for (i = 1; i < d->num_rooms; i++) {
-    connect_two_rooms(d, d->rooms + i - 1, d->rooms + i);
+    connect_two_rooms(d, &s, d->rooms + i - 1, d->rooms + i);
   }
 
-  create_cycle(d);
+  create_cycle(d, &s);
+
+  heap_pool_delete(s.pool);
 
   return 0;
 }
 
-int gaussian[5][5] = {
+static const int32_t gaussian[5][5] = {
   {  1,  4,  7,  4,  1 },
   {  4, 16, 26, 16,  4 },
   {  7, 26, 41, 26,  7 },
@@ -347,164 +317,156 @@ int gaussian[5][5] = {
   {  1,  4,  7,  4,  1 }
 };
 
-typedef struct queue_node {
-  int x, y;
-  struct queue_node *next;
-} queue_node_t;
+/* The hardness map is worked on with a two-cell margin all round, so  *
+ * that neither the diffusion nor the convolution needs bounds checks. */
+#define SMOOTH_PAD 2
+
+/* How many default-sized dungeons would fit inside this one.  Room  *
+ * counts and hardness seeds are multiplied by this, so that a big   *
+ * dungeon looks like a lot of default ones side by side.            */
+static uint32_t dungeon_scale(dungeon *d)
+{
+  return (((d->width - 2) * (d->height - 2)) /
+          ((DUNGEON_X - 2) * (DUNGEON_Y - 2)));
+}
+
+/* Near the edges, part of the kernel falls off the map, and the result *
+ * is normalized by the part that doesn't.  The kernel is g x g, less a *
+ * correction in the middle (see smooth_hardness()), and the part of    *
+ * g x g on the map is a rectangle, so its sum at (x, y) is             *
+ * on[x] * on[y], where on[] sums g over the taps inside the map in one *
+ * dimension.  The correction subtracts 2 for each orthogonal neighbor  *
+ * on the map and 8 for the center.                                     */
+static void gaussian_weights(std::vector<int32_t> &on,
+                             std::vector<int32_t> &orthogonal, int32_t size)
+{
+  int32_t i, p;
+
+  on.resize(size);
+  orthogonal.resize(size);
+  for (i = 0; i < size; i++) {
+    /* The first row of the kernel is g itself. */
+    for (on[i] = p = 0; p < 5; p++) {
+      if (i + (p - 2) >= 0 && i + (p - 2) < size) {
+        on[i] += gaussian[0][p];
+      }
+    }
+    orthogonal[i] = (i > 0) + (i < size - 1);
+  }
+}
 
 static int smooth_hardness(dungeon *d)
 {
+  const int32_t stride = d->width + 2 * SMOOTH_PAD;
+  /* Neighbor offsets in the padded map, in the order the cells are *
+   * visited, which determines which seed wins a contested cell.    */
+  const int32_t neighbor[8] = {
+    -stride - 1, -1, stride - 1,
+    -stride,         stride,
+    -stride + 1,  1, stride + 1
+  };
   int32_t i, x, y;
-  int32_t s, t, p, q;
-  queue_node_t *head, *tail, *tmp;
+  int32_t t;
+  uint32_t head, tail, n, s, scale;
+  std::vector<uint32_t> queue(d->hardness.size());
+  std::vector<int32_t> on_x, on_y, orthogonal_x, orthogonal_y;
+  /* The margin starts out nonzero, so the diffusion sees it as *
+   * already filled and never spills into it.                   */
+  grid<uint8_t> hardness(stride, d->height + 2 * SMOOTH_PAD, 1);
+  grid<int32_t> row(d->width, d->height + 2 * SMOOTH_PAD);
+  uint8_t *h;
 #if DUMP_HARDNESS_IMAGES
   FILE *out;
 #endif
-  uint8_t hardness[DUNGEON_Y][DUNGEON_X];
 
-  memset(&hardness, 0, sizeof (hardness));
+  h = hardness.data();
+  for (y = SMOOTH_PAD; y < d->height + SMOOTH_PAD; y++) {
+    memset(&hardness[y][SMOOTH_PAD], 0, d->width);
+  }
 
   /* Seed with some values */
-  for (i = 1; i < 255; i += 20) {
-    do {
-      x = rand() % DUNGEON_X;
-      y = rand() % DUNGEON_Y;
-    } while (hardness[y][x]);
-    hardness[y][x] = i;
-    if (i == 1) {
-      head = tail = (queue_node_t *) malloc(sizeof (*tail));
-    } else {
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
+  scale = dungeon_scale(d);
+  for (head = tail = s = 0; s < scale; s++) {
+    for (i = 1; i < 255; i += 20) {
+      do {
+        x = d->map_rng.under(d->width);
+        y = d->map_rng.under(d->height);
+      } while (hardness[y + SMOOTH_PAD][x + SMOOTH_PAD]);
+      hardness[y + SMOOTH_PAD][x + SMOOTH_PAD] = i;
+      queue[tail++] = (y + SMOOTH_PAD) * stride + x + SMOOTH_PAD;
     }
-    tail->next = NULL;
-    tail->x = x;
-    tail->y = y;
   }
 
 #if DUMP_HARDNESS_IMAGES
   out = fopen("seeded.pgm", "w");
-  fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&hardness, sizeof (hardness), 1, out);
+  fprintf(out, "P5\n%u %u\n255\n", d->width, d->height);
+  for (y = SMOOTH_PAD; y < d->height + SMOOTH_PAD; y++) {
+    fwrite(&hardness[y][SMOOTH_PAD], d->width, 1, out);
+  }
   fclose(out);
 #endif
   
-  /* Diffuse the vaules to fill the space */
-  while (head) {
-    x = head->x;
-    y = head->y;
-    i = hardness[y][x];
-
-    if (x - 1 >= 0 && y - 1 >= 0 && !hardness[y - 1][x - 1]) {
-      hardness[y - 1][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y - 1;
-    }
-    if (x - 1 >= 0 && !hardness[y][x - 1]) {
-      hardness[y][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y;
-    }
-    if (x - 1 >= 0 && y + 1 < DUNGEON_Y && !hardness[y + 1][x - 1]) {
-      hardness[y + 1][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y + 1;
-    }
-    if (y - 1 >= 0 && !hardness[y - 1][x]) {
-      hardness[y - 1][x] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x;
-      tail->y = y - 1;
-    }
-    if (y + 1 < DUNGEON_Y && !hardness[y + 1][x]) {
-      hardness[y + 1][x] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x;
-      tail->y = y + 1;
-    }
-    if (x + 1 < DUNGEON_X && y - 1 >= 0 && !hardness[y - 1][x + 1]) {
-      hardness[y - 1][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y - 1;
-    }
-    if (x + 1 < DUNGEON_X && !hardness[y][x + 1]) {
-      hardness[y][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y;
-    }
-    if (x + 1 < DUNGEON_X && y + 1 < DUNGEON_Y && !hardness[y + 1][x + 1]) {
-      hardness[y + 1][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y + 1;
+  /* Diffuse the vaules to fill the space.  Every cell is queued *
+   * exactly once, so the queue never needs to wrap.             */
+  while (head < tail) {
+    n = queue[head++];
+    for (i = 0; i < 8; i++) {
+      if (!h[n + neighbor[i]]) {
+        h[n + neighbor[i]] = h[n];
+        queue[tail++] = n + neighbor[i];
+      }
     }
+  }
 
-    tmp = head;
-    head = head->next;
-    free(tmp);
+  /* Now the margin has to read as zero for the convolution. */
+  memset(hardness[0], 0, SMOOTH_PAD * stride);
+  memset(hardness[d->height + SMOOTH_PAD], 0, SMOOTH_PAD * stride);
+  for (y = SMOOTH_PAD; y < d->height + SMOOTH_PAD; y++) {
+    hardness[y][0] = hardness[y][1] = 0;
+    hardness[y][stride - 2] = hardness[y][stride - 1] = 0;
   }
 
-  /* And smooth it a bit with a gaussian convolution */
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      for (s = t = p = 0; p < 5; p++) {
-        for (q = 0; q < 5; q++) {
-          if (y + (p - 2) >= 0 && y + (p - 2) < DUNGEON_Y &&
-              x + (q - 2) >= 0 && x + (q - 2) < DUNGEON_X) {
-            s += gaussian[p][q];
-            t += hardness[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
-          }
-        }
-      }
-      d->hardness[y][x] = t / s;
+  /* And smooth it a bit with a gaussian convolution.  The kernel is *
+   * g x g, g = { 1, 4, 7, 4, 1 }, except in the middle, where g x g *
+   * has 28 for 26 and 49 for 41.  So it's a horizontal pass and a   *
+   * vertical pass with g, less twice the four orthogonal neighbors  *
+   * and eight times the center.  Same sums, exactly.                */
+  gaussian_weights(on_x, orthogonal_x, d->width);
+  gaussian_weights(on_y, orthogonal_y, d->height);
+  for (y = 0; y < d->height + 2 * SMOOTH_PAD; y++) {
+    for (x = 0; x < d->width; x++) {
+      row[y][x] = (hardness[y][x]         + 4 * hardness[y][x + 1] +
+                   7 * hardness[y][x + 2] + 4 * hardness[y][x + 3] +
+                   hardness[y][x + 4]);
     }
   }
-  /* Let's do it again, until it's smooth like Kenny G. */
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      for (s = t = p = 0; p < 5; p++) {
-        for (q = 0; q < 5; q++) {
-          if (y + (p - 2) >= 0 && y + (p - 2) < DUNGEON_Y &&
-              x + (q - 2) >= 0 && x + (q - 2) < DUNGEON_X) {
-            s += gaussian[p][q];
-            t += hardness[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
-          }
-        }
-      }
-      d->hardness[y][x] = t / s;
+  for (y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
+      t = (row[y][x]         + 4 * row[y + 1][x] +
+           7 * row[y + 2][x] + 4 * row[y + 3][x] +
+           row[y + 4][x]);
+      t -= 2 * (hardness[y + 1][x + 2] + hardness[y + 3][x + 2] +
+                hardness[y + 2][x + 1] + hardness[y + 2][x + 3]);
+      t -= 8 * hardness[y + 2][x + 2];
+      d->hardness[y][x] = t / (on_y[y] * on_x[x] -
+                               2 * (orthogonal_y[y] + orthogonal_x[x]) - 8);
     }
   }
+  /* This used to do it again, until it was smooth like Kenny G., but *
+   * the second pass read the same unsmoothed input as the first, so  *
+   * it only ever reproduced the first pass's result.                 */
 
 #if DUMP_HARDNESS_IMAGES
   out = fopen("diffused.pgm", "w");
-  fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&hardness, sizeof (hardness), 1, out);
+  fprintf(out, "P5\n%u %u\n255\n", d->width, d->height);
+  for (y = SMOOTH_PAD; y < d->height + SMOOTH_PAD; y++) {
+    fwrite(&hardness[y][SMOOTH_PAD], d->width, 1, out);
+  }
   fclose(out);
 
   out = fopen("smoothed.pgm", "w");
-  fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&d->hardness, sizeof (d->hardness), 1, out);
+  fprintf(out, "P5\n%u %u\n255\n", d->width, d->height);
+  fwrite(d->hardness.data(), d->hardness.size(), 1, out);
   fclose(out);
 #endif
 
@@ -513,14 +475,14 @@ static int smooth_hardness(dungeon *d)
 
 static int empty_dungeon(dungeon *d)
 {
-  uint8_t x, y;
+  uint32_t x, y;
 
   smooth_hardness(d);
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
       mapxy(x, y) = ter_wall;
-      if (y == 0 || y == DUNGEON_Y - 1 ||
-          x == 0 || x == DUNGEON_X - 1) {
+      if (y == 0 || y == d->height - 1U ||
+          x == 0 || x == d->width - 1U) {
         mapxy(x, y) = ter_wall_immutable;
         hardnessxy(x, y) = 255;
       }
@@ -532,63 +494,91 @@ static int empty_dungeon(dungeon *d)
   return 0;
 }
 
+/* Rooms may not overlap or touch, so this checks a one-cell border, too. */
+static uint32_t room_fits(dungeon *d, room_t *r)
+{
+  pair_t p;
+
+  for (p[dim_y] = r->position[dim_y] - 1;
+       p[dim_y] < r->position[dim_y] + r->size[dim_y] + 1;
+       p[dim_y]++) {
+    for (p[dim_x] = r->position[dim_x] - 1;
+         p[dim_x] < r->position[dim_x] + r->size[dim_x] + 1;
+         p[dim_x]++) {
+      if (mappair(p) >= ter_floor) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+/* Places each room in turn, keeping the ones already placed.  A room   *
+ * that doesn't fit after ROOM_PLACEMENT_ATTEMPTS random positions is   *
+ * dropped.  Returns nonzero if that leaves fewer than MIN_ROOMS.       */
 static int place_rooms(dungeon *d)
 {
   pair_t p;
-  uint32_t i;
-  int success;
+  uint32_t i, attempts;
   room_t *r;
 
-  for (success = 0; !success; ) {
-    success = 1;
-    for (i = 0; success && i < d->num_rooms; i++) {
-      r = d->rooms + i;
-      r->position[dim_x] = 1 + rand() % (DUNGEON_X - 2 - r->size[dim_x]);
-      r->position[dim_y] = 1 + rand() % (DUNGEON_Y - 2 - r->size[dim_y]);
-      for (p[dim_y] = r->position[dim_y] - 1;
-           success && p[dim_y] < r->position[dim_y] + r->size[dim_y] + 1;
-           p[dim_y]++) {
-        for (p[dim_x] = r->position[dim_x] - 1;
-             success && p[dim_x] < r->position[dim_x] + r->size[dim_x] + 1;
-             p[dim_x]++) {
-          if (mappair(p) >= ter_floor) {
-            success = 0;
-            empty_dungeon(d);
-          } else if ((p[dim_y] != r->position[dim_y] - 1)              &&
-                     (p[dim_y] != r->position[dim_y] + r->size[dim_y]) &&
-                     (p[dim_x] != r->position[dim_x] - 1)              &&
-                     (p[dim_x] != r->position[dim_x] + r->size[dim_x])) {
-            mappair(p) = ter_floor_room;
-            hardnesspair(p) = 0;
-          }
-        }
+  for (i = 0; i < d->num_rooms; ) {
+    r = d->rooms + i;
+    for (attempts = 0; attempts < ROOM_PLACEMENT_ATTEMPTS; attempts++) {
+      r->position[dim_x] = 1 + d->map_rng.under(d->width - 2 -
+                                                r->size[dim_x]);
+      r->position[dim_y] = 1 + d->map_rng.under(d->height - 2 -
+                                                r->size[dim_y]);
+      d->room_attempts++;
+      if (room_fits(d, r)) {
+        break;
       }
+      d->room_retries++;
+    }
+
+    if (attempts == ROOM_PLACEMENT_ATTEMPTS) {
+      memmove(r, r + 1, (d->num_rooms - i - 1) * sizeof (*r));
+      d->num_rooms--;
+      continue;
     }
+
+    for (p[dim_y] = r->position[dim_y];
+         p[dim_y] < r->position[dim_y] + r->size[dim_y];
+         p[dim_y]++) {
+      for (p[dim_x] = r->position[dim_x];
+           p[dim_x] < r->position[dim_x] + r->size[dim_x];
+           p[dim_x]++) {
+        mappair(p) = ter_floor_room;
+        hardnesspair(p) = 0;
+      }
+    }
+    i++;
   }
 
-  return 0;
+  return d->num_rooms < MIN_ROOMS;
 }
 
 static void place_stairs(dungeon *d)
 {
   pair_t p;
   do {
-    while ((p[dim_y] = rand_range(1, DUNGEON_Y - 2)) &&
-           (p[dim_x] = rand_range(1, DUNGEON_X - 2)) &&
-           ((mappair(p) < ter_floor)                 ||
+    while ((p[dim_y] = d->map_rng.range(1, d->height - 2)) &&
+           (p[dim_x] = d->map_rng.range(1, d->width - 2)) &&
+           ((mappair(p) < ter_floor)                       ||
             (mappair(p) > ter_stairs)))
       ;
     mappair(p) = ter_stairs_down;
-  } while (rand_under(1, 3));
+  } while (d->map_rng.chance(1, 3));
   do {
-    while ((p[dim_y] = rand_range(1, DUNGEON_Y - 2)) &&
-           (p[dim_x] = rand_range(1, DUNGEON_X - 2)) &&
-           ((mappair(p) < ter_floor)                 ||
+    while ((p[dim_y] = d->map_rng.range(1, d->height - 2)) &&
+           (p[dim_x] = d->map_rng.range(1, d->width - 2)) &&
+           ((mappair(p) < ter_floor)                       ||
             (mappair(p) > ter_stairs)))
       
       ;
     mappair(p) = ter_stairs_up;
-  } while (rand_under(2, 4));
+  } while (d->map_rng.chance(2, 4));
 }
 
 //Lee's
@@ -596,30 +586,30 @@ static void place_store(dungeon *d)
 {
   pair_t p;
   do {
-    while ((p[dim_y] = rand_range(1, DUNGEON_Y - 2)) &&
-           (p[dim_x] = rand_range(1, DUNGEON_X - 2)) &&     
+    while ((p[dim_y] = d->map_rng.range(1, d->height - 2)) &&
+           (p[dim_x] = d->map_rng.range(1, d->width - 2)) &&     
           (mappair(p) != ter_floor_room))
       ;
     mappair(p) = ter_store;
-  } while (rand_under(0,1));
+  } while (d->map_rng.chance(0,1));
 }
 
 static int make_rooms(dungeon *d)
 {
   uint32_t i;
 
-  for (i = MIN_ROOMS; i < MAX_ROOMS && rand_under(5, 8); i++)
+  for (i = MIN_ROOMS; i < MAX_ROOMS && d->map_rng.chance(5, 8); i++)
     ;
-  d->num_rooms = i;
+  d->num_rooms = i * dungeon_scale(d);
   d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
   
   for (i = 0; i < d->num_rooms; i++) {
     d->rooms[i].size[dim_x] = ROOM_MIN_X;
     d->rooms[i].size[dim_y] = ROOM_MIN_Y;
-    while (rand_under(3, 5) && d->rooms[i].size[dim_x] < ROOM_MAX_X) {
+    while (d->map_rng.chance(3, 5) && d->rooms[i].size[dim_x] < ROOM_MAX_X) {
       d->rooms[i].size[dim_x]++;
     }
-    while (rand_under(3, 5) && d->rooms[i].size[dim_y] < ROOM_MAX_Y) {
+    while (d->map_rng.chance(3, 5) && d->rooms[i].size[dim_y] < ROOM_MAX_Y) {
       d->rooms[i].size[dim_y]++;
     }
   }
@@ -629,11 +619,17 @@ static int make_rooms(dungeon *d)
 
 int gen_dungeon(dungeon *d)
 {
-  empty_dungeon(d);
+  d->room_attempts = d->room_retries = d->gen_restarts = 0;
 
-  do {
+  empty_dungeon(d);
+  make_rooms(d);
+  while (place_rooms(d)) {
+    /* Start over with a new set of rooms. */
+    d->gen_restarts++;
+    free(d->rooms);
+    empty_dungeon(d);
     make_rooms(d);
-  } while (place_rooms(d));
+  }
   connect_rooms(d);
   place_stairs(d);
   place_store(d);
@@ -646,8 +642,8 @@ void render_dungeon(dungeon *d)
   pair_t p;
 
   putchar('\n');
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+  for (p[dim_y] = 0; p[dim_y] < d->height; p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < d->width; p[dim_x]++) {
       if (charpair(p)) {
         putchar(charpair(p)->symbol);
       } else {
@@ -687,34 +683,169 @@ void render_dungeon(dungeon *d)
 void delete_dungeon(dungeon *d)
 {
   free(d->rooms);
-  heap_delete(&d->events);
-  memset(d->character_map, 0, sizeof (d->character_map));
+  event_queue_delete(&d->events);
+  d->character_map.fill(NULL);
+  d->monsters.clear();
   destroy_objects(d);
+  free(d->hunt_walk.goals);
+  d->hunt_walk.goals = NULL;
+  d->hunt_walk.goals_size = 0;
+  free(d->hunt_tunnel.goals);
+  d->hunt_tunnel.goals = NULL;
+  d->hunt_tunnel.goals_size = 0;
+  if (d->path_queue.capacity) {
+    bucket_queue_delete(&d->path_queue);
+  }
+  if (d->ai_pool) {
+    work_pool_delete(d->ai_pool);
+    free(d->ai_pool);
+    d->ai_pool = NULL;
+  }
+}
+
+void init_dungeon(dungeon *d)
+{
+  empty_dungeon(d);
+  path_terrain_changed(d, NULL, 0);
+  event_queue_init(&d->events);
+  d->character_map.fill(NULL);
+  d->monsters.clear();
+  d->objmap.fill(NULL);
 }
 
-void init_dungeon(dungeon *d)
-{
-  empty_dungeon(d);
-  memset(&d->events, 0, sizeof (d->events));
-  heap_init(&d->events, compare_events, event_delete);
-  memset(d->character_map, 0, sizeof (d->character_map));
-  memset(d->objmap, 0, sizeof (d->objmap));
+/* Brings walkable and immutable up to date with the whole map. */
+void terrain_layers_rebuild(dungeon *d)
+{
+  uint32_t x, y;
+
+  for (y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
+      d->walkable.set(y, x, mapxy(x, y) >= ter_floor);
+      d->immutable.set(y, x, mapxy(x, y) == ter_wall_immutable);
+    }
+  }
+  d->layers_terrain_generation = d->terrain_generation;
+}
+
+/* Brings walkable and immutable up to date with just these cells. */
+void terrain_layers_set(dungeon *d, pair_t *cells, uint32_t num_cells)
+{
+  uint32_t n;
+
+  for (n = 0; n < num_cells; n++) {
+    d->walkable.set(cells[n][dim_y], cells[n][dim_x],
+                    mappair(cells[n]) >= ter_floor);
+    d->immutable.set(cells[n][dim_y], cells[n][dim_x],
+                     mappair(cells[n]) == ter_wall_immutable);
+  }
+}
+
+/* Everything on the old maps is lost, so this comes before the first *
+ * init_dungeon(), or before reading a dungeon from a file.           */
+void resize_dungeon(dungeon *d, uint16_t width, uint16_t height)
+{
+  uint32_t walk, tunnel;
+  uint64_t longest;
+
+  if (width < DUNGEON_X || width > DUNGEON_MAX_X ||
+      height < DUNGEON_Y || height > DUNGEON_MAX_Y) {
+    fprintf(stderr, "Dungeon size %ux%u is not between %ux%u and %ux%u.\n",
+            width, height, DUNGEON_X, DUNGEON_Y, DUNGEON_MAX_X, DUNGEON_MAX_Y);
+    exit(-1);
+  }
+
+  d->width = width;
+  d->height = height;
+  d->map.resize(width, height, ter_wall);
+  d->hardness.resize(width, height);
+  d->walkable.resize(width, height);
+  d->immutable.resize(width, height);
+  d->los_known[0].resize(width, height);
+  d->los_known[1].resize(width, height);
+  d->los_seen[0].resize(width, height);
+  d->los_seen[1].resize(width, height);
+  /* The default dungeon has always had one-byte distance maps, which  *
+   * saturate at 254, well past anything that matters on one screen.   *
+   * Bigger ones are sized for the longest possible path, which visits *
+   * every interior cell at most once.  Tunneling can't promise to go  *
+   * straight across: a loaded map may wall it in with immutable rock  *
+   * and send it the long way around, at up to TUNNEL_MAX_COST a step. *
+   * So on a bigger map, no reachable cell ever reads as infinity().   */
+  if (width == DUNGEON_X && height == DUNGEON_Y) {
+    walk = tunnel = UINT8_MAX - 1;
+  } else {
+    walk = (width - 2) * (height - 2);
+    longest = (uint64_t) walk * TUNNEL_MAX_COST;
+    tunnel = longest < UINT32_MAX ? longest : UINT32_MAX - 1;
+  }
+  d->pc_distance.resize(width, height, walk);
+  d->pc_tunnel.resize(width, height, tunnel);
+  d->path_cache.clear();
+  d->hunt_walk.dist.resize(width, height, walk);
+  d->hunt_tunnel.dist.resize(width, height, tunnel);
+  d->character_map.resize(width, height);
+  d->monsters.resize(width, height);
+  d->objmap.resize(width, height);
+}
+
+void seed_dungeon(dungeon *d, uint32_t seed)
+{
+  /* Same seed, different stream for each subsystem. */
+  d->map_rng.seed(seed, 0);
+  d->ai_rng.seed(seed, 1);
+  d->combat_rng.seed(seed, 2);
+  d->loot_rng.seed(seed, 3);
+  d->autopilot_rng.seed(seed, 4);
+  d->autopilot_seen_corner = 0;
+  d->autopilot_corner_turns = 0;
+}
+
+/* Version 0 save files hold a default-sized dungeon, and every    *
+ * coordinate in them is a single byte.  Anything bigger is saved  *
+ * as version 1, which has the dungeon's width and height, 16 bits *
+ * each, after the file size, and 16-bit big-endian coordinates.   */
+static uint32_t save_version(dungeon *d)
+{
+  return ((d->width == DUNGEON_X && d->height == DUNGEON_Y) ?
+          DUNGEON_SAVE_VERSION : DUNGEON_SAVE_VERSION_LARGE);
+}
+
+static void write_coordinate(FILE *f, uint32_t version, int16_t c)
+{
+  uint16_t be16;
+  uint8_t b;
+
+  if (version == DUNGEON_SAVE_VERSION) {
+    b = c;
+    fwrite(&b, 1, 1, f);
+  } else {
+    be16 = htobe16(c);
+    fwrite(&be16, 2, 1, f);
+  }
+}
+
+static int16_t read_coordinate(FILE *f, uint32_t version)
+{
+  uint16_t be16;
+  uint8_t b;
+
+  if (version == DUNGEON_SAVE_VERSION) {
+    fread(&b, 1, 1, f);
+    return b;
+  }
+  fread(&be16, 2, 1, f);
+
+  return be16toh(be16);
 }
 
 int write_dungeon_map(dungeon *d, FILE *f)
 {
-  uint32_t x, y;
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      fwrite(&d->hardness[y][x], sizeof (unsigned char), 1, f);
-    }
-  }
+  fwrite(d->hardness.data(), 1, d->hardness.size(), f);
 
   return 0;
 }
 
-int write_rooms(dungeon *d, FILE *f)
+int write_rooms(dungeon *d, FILE *f, uint32_t version)
 {
   uint32_t i;
   uint16_t p;
@@ -723,14 +854,10 @@ int write_rooms(dungeon *d, FILE *f)
   fwrite(&p, 2, 1, f);
   for (i = 0; i < d->num_rooms; i++) {
     /* write order is xpos, ypos, width, height */
-    p = d->rooms[i].position[dim_x];
-    fwrite(&p, 1, 1, f);
-    p = d->rooms[i].position[dim_y];
-    fwrite(&p, 1, 1, f);
-    p = d->rooms[i].size[dim_x];
-    fwrite(&p, 1, 1, f);
-    p = d->rooms[i].size[dim_y];
-    fwrite(&p, 1, 1, f);
+    write_coordinate(f, version, d->rooms[i].position[dim_x]);
+    write_coordinate(f, version, d->rooms[i].position[dim_y]);
+    write_coordinate(f, version, d->rooms[i].size[dim_x]);
+    write_coordinate(f, version, d->rooms[i].size[dim_y]);
   }
 
   return 0;
@@ -741,8 +868,8 @@ uint16_t count_up_stairs(dungeon *d)
   uint32_t x, y;
   uint16_t i;
 
-  for (i = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
+  for (i = 0, y = 1; y < d->height - 1U; y++) {
+    for (x = 1; x < d->width - 1U; x++) {
       if (mapxy(x, y) == ter_stairs_up) {
         i++;
       }
@@ -757,8 +884,8 @@ uint16_t count_down_stairs(dungeon *d)
   uint32_t x, y;
   uint16_t i;
 
-  for (i = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
+  for (i = 0, y = 1; y < d->height - 1U; y++) {
+    for (x = 1; x < d->width - 1U; x++) {
       if (mapxy(x, y) == ter_stairs_down) {
         i++;
       }
@@ -768,31 +895,33 @@ uint16_t count_down_stairs(dungeon *d)
   return i;
 }
 
-int write_stairs(dungeon *d, FILE *f)
+int write_stairs(dungeon *d, FILE *f, uint32_t version)
 {
-  uint16_t num_stairs;
-  uint8_t x, y;
-
-  num_stairs = htobe16(count_up_stairs(d));
-  fwrite(&num_stairs, 2, 1, f);
-  for (y = 1; y < DUNGEON_Y - 1 && num_stairs; y++) {
-    for (x = 1; x < DUNGEON_X - 1 && num_stairs; x++) {
+  uint16_t num_stairs, be16;
+  int16_t x, y;
+
+  num_stairs = count_up_stairs(d);
+  be16 = htobe16(num_stairs);
+  fwrite(&be16, 2, 1, f);
+  for (y = 1; y < d->height - 1 && num_stairs; y++) {
+    for (x = 1; x < d->width - 1 && num_stairs; x++) {
       if (mapxy(x, y) == ter_stairs_up) {
         num_stairs--;
-        fwrite(&x, 1, 1, f);
-        fwrite(&y, 1, 1, f);
+        write_coordinate(f, version, x);
+        write_coordinate(f, version, y);
       }
     }
   }
 
-  num_stairs = htobe16(count_down_stairs(d));
-  fwrite(&num_stairs, 2, 1, f);
-  for (y = 1; y < DUNGEON_Y - 1 && num_stairs; y++) {
-    for (x = 1; x < DUNGEON_X - 1 && num_stairs; x++) {
+  num_stairs = count_down_stairs(d);
+  be16 = htobe16(num_stairs);
+  fwrite(&be16, 2, 1, f);
+  for (y = 1; y < d->height - 1 && num_stairs; y++) {
+    for (x = 1; x < d->width - 1 && num_stairs; x++) {
       if (mapxy(x, y) == ter_stairs_down) {
         num_stairs--;
-        fwrite(&x, 1, 1, f);
-        fwrite(&y, 1, 1, f);
+        write_coordinate(f, version, x);
+        write_coordinate(f, version, y);
       }
     }
   }
@@ -805,10 +934,18 @@ uint32_t calculate_dungeon_size(dungeon *d)
   /* Per the spec, 1708 is 12 byte semantic marker + 4 byte file verion + *
    * 4 byte file size + 2 byte PC position + 1680 byte hardness array +   *
    * 2 byte each number of rooms, number of up stairs, number of down     *
-   * stairs.                                                              */
-  return (1708 + (d->num_rooms * 4) +
-          (count_up_stairs(d) * 2)  +
-          (count_down_stairs(d) * 2));
+   * stairs.  Version 1 adds 4 bytes of dungeon size, and has twice as    *
+   * many bytes in each position.                                         */
+  if (save_version(d) == DUNGEON_SAVE_VERSION) {
+    return (1708 + (d->num_rooms * 4) +
+            (count_up_stairs(d) * 2)  +
+            (count_down_stairs(d) * 2));
+  }
+
+  return (12 + 4 + 4 + 4 + 4 + d->hardness.size() + 2 + 2 + 2 +
+          (d->num_rooms * 8)        +
+          (count_up_stairs(d) * 4)  +
+          (count_down_stairs(d) * 4));
 }
 
 int write_dungeon(dungeon *d, char *file)
@@ -817,7 +954,8 @@ int write_dungeon(dungeon *d, char *file)
   char *filename;
   FILE *f;
   size_t len;
-  uint32_t be32;
+  uint32_t be32, version;
+  uint16_t be16;
 
   if (!file) {
     if (!(home = getenv("HOME"))) {
@@ -852,38 +990,69 @@ int write_dungeon(dungeon *d, char *file)
   fwrite(DUNGEON_SAVE_SEMANTIC, 1, sizeof (DUNGEON_SAVE_SEMANTIC) - 1, f);
 
   /* The version, 4 bytes, 12-15 */
-  be32 = htobe32(DUNGEON_SAVE_VERSION);
+  version = save_version(d);
+  be32 = htobe32(version);
   fwrite(&be32, sizeof (be32), 1, f);
 
   /* The size of the file, 4 bytes, 16-19 */
   be32 = htobe32(calculate_dungeon_size(d));
   fwrite(&be32, sizeof (be32), 1, f);
 
+  /* Version 1 only: the dungeon size, 4 bytes, 20-23, which moves  *
+   * everything after it along.  The offsets below are version 0's. */
+  if (version == DUNGEON_SAVE_VERSION_LARGE) {
+    be16 = htobe16(d->width);
+    fwrite(&be16, sizeof (be16), 1, f);
+    be16 = htobe16(d->height);
+    fwrite(&be16, sizeof (be16), 1, f);
+  }
+
   /* The PC position, 2 bytes, 20-21 */
-  fwrite(&d->PC->position[dim_x], 1, 1, f);
-  fwrite(&d->PC->position[dim_y], 1, 1, f);
+  write_coordinate(f, version, d->PC->position[dim_x]);
+  write_coordinate(f, version, d->PC->position[dim_y]);
 
   /* The dungeon map, 1680 bytes, 22-1702 */
   write_dungeon_map(d, f);
 
   /* The rooms, num_rooms * 4 bytes, 1703-end */
-  write_rooms(d, f);
+  write_rooms(d, f, version);
 
   /* And the stairs */
-  write_stairs(d, f);
+  write_stairs(d, f, version);
 
   fclose(f);
 
   return 0;
 }
 
+/* Pathfinding never checks bounds; it relies on the outer ring of the *
+ * map being immutable wall, which nothing can path through.  Every    *
+ * dungeon gets one here, whatever the file it came from says.         */
+static void seal_border(dungeon *d)
+{
+  uint32_t x, y;
+
+  for (x = 0; x < d->width; x++) {
+    d->map[0][x] = ter_wall_immutable;
+    d->hardness[0][x] = 255;
+    d->map[d->height - 1][x] = ter_wall_immutable;
+    d->hardness[d->height - 1][x] = 255;
+  }
+  for (y = 1; y < d->height - 1U; y++) {
+    d->map[y][0] = ter_wall_immutable;
+    d->hardness[y][0] = 255;
+    d->map[y][d->width - 1] = ter_wall_immutable;
+    d->hardness[y][d->width - 1] = 255;
+  }
+}
+
 int read_dungeon_map(dungeon *d, FILE *f)
 {
   uint32_t x, y;
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      fread(&d->hardness[y][x], sizeof (d->hardness[y][x]), 1, f);
+  fread(d->hardness.data(), 1, d->hardness.size(), f);
+  for (y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
       if (d->hardness[y][x] == 0) {
         /* Mark it as a corridor.  We can't recognize room cells until *
          * after we've read the room array, which we haven't done yet. */
@@ -895,35 +1064,35 @@ int read_dungeon_map(dungeon *d, FILE *f)
       }
     }
   }
-
+  seal_border(d);
 
   return 0;
 }
 
-int read_stairs(dungeon *d, FILE *f)
+int read_stairs(dungeon *d, FILE *f, uint32_t version)
 {
   uint16_t num_stairs;
-  uint8_t x, y;
+  int16_t x, y;
 
   fread(&num_stairs, 2, 1, f);
   num_stairs = be16toh(num_stairs);
   for (; num_stairs; num_stairs--) {
-    fread(&x, 1, 1, f);
-    fread(&y, 1, 1, f);
+    x = read_coordinate(f, version);
+    y = read_coordinate(f, version);
     mapxy(x, y) = ter_stairs_up;
   }
 
   fread(&num_stairs, 2, 1, f);
   num_stairs = be16toh(num_stairs);
   for (; num_stairs; num_stairs--) {
-    fread(&x, 1, 1, f);
-    fread(&y, 1, 1, f);
+    x = read_coordinate(f, version);
+    y = read_coordinate(f, version);
     mapxy(x, y) = ter_stairs_down;
   }
   return 0;
 }
 
-int read_rooms(dungeon *d, FILE *f)
+int read_rooms(dungeon *d, FILE *f, uint32_t version)
 {
   uint32_t i;
   int32_t x, y;
@@ -934,32 +1103,28 @@ int read_rooms(dungeon *d, FILE *f)
   d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
 
   for (i = 0; i < d->num_rooms; i++) {
-    fread(&p, 1, 1, f);
-    d->rooms[i].position[dim_x] = p;
-    fread(&p, 1, 1, f);
-    d->rooms[i].position[dim_y] = p;
-    fread(&p, 1, 1, f);
-    d->rooms[i].size[dim_x] = p;
-    fread(&p, 1, 1, f);
-    d->rooms[i].size[dim_y] = p;
+    d->rooms[i].position[dim_x] = read_coordinate(f, version);
+    d->rooms[i].position[dim_y] = read_coordinate(f, version);
+    d->rooms[i].size[dim_x] = read_coordinate(f, version);
+    d->rooms[i].size[dim_y] = read_coordinate(f, version);
 
     if (d->rooms[i].size[dim_x] < 1             ||
         d->rooms[i].size[dim_y] < 1             ||
-        d->rooms[i].size[dim_x] > DUNGEON_X - 1 ||
-        d->rooms[i].size[dim_y] > DUNGEON_X - 1) {
+        d->rooms[i].size[dim_x] > d->width - 1  ||
+        d->rooms[i].size[dim_y] > d->height - 1) {
       fprintf(stderr, "Invalid room size in restored dungeon.\n");
 
       exit(-1);
     }
 
-    if (d->rooms[i].position[dim_x] < 1                                       ||
-        d->rooms[i].position[dim_y] < 1                                       ||
-        d->rooms[i].position[dim_x] > DUNGEON_X - 1                           ||
-        d->rooms[i].position[dim_y] > DUNGEON_Y - 1                           ||
-        d->rooms[i].position[dim_x] + d->rooms[i].size[dim_x] > DUNGEON_X - 1 ||
-        d->rooms[i].position[dim_x] + d->rooms[i].size[dim_x] < 0             ||
-        d->rooms[i].position[dim_y] + d->rooms[i].size[dim_y] > DUNGEON_Y - 1 ||
-        d->rooms[i].position[dim_y] + d->rooms[i].size[dim_y] < 0)             {
+    if (d->rooms[i].position[dim_x] < 1                                      ||
+        d->rooms[i].position[dim_y] < 1                                      ||
+        d->rooms[i].position[dim_x] > d->width - 1                           ||
+        d->rooms[i].position[dim_y] > d->height - 1                          ||
+        d->rooms[i].position[dim_x] + d->rooms[i].size[dim_x] > d->width - 1 ||
+        d->rooms[i].position[dim_x] + d->rooms[i].size[dim_x] < 0            ||
+        d->rooms[i].position[dim_y] + d->rooms[i].size[dim_y] > d->height - 1 ||
+        d->rooms[i].position[dim_y] + d->rooms[i].size[dim_y] < 0)            {
       fprintf(stderr, "Invalid room position in restored dungeon.\n");
 
       exit(-1);
@@ -990,6 +1155,9 @@ int read_dungeon(dungeon *d, char *file)
   size_t len;
   char *filename;
   struct stat buf;
+  uint32_t version;
+  uint16_t width, height;
+  int16_t x, y;
 
   if (!file) {
     if (!(home = getenv("HOME"))) {
@@ -1037,7 +1205,9 @@ int read_dungeon(dungeon *d, char *file)
     exit(-1);
   }
   fread(&be32, sizeof (be32), 1, f);
-  if (be32toh(be32) != 0) { /* Since we expect zero, be32toh() is a no-op. */
+  version = be32toh(be32);
+  if (version != DUNGEON_SAVE_VERSION &&
+      version != DUNGEON_SAVE_VERSION_LARGE) {
     fprintf(stderr, "File version mismatch.\n");
     exit(-1);
   }
@@ -1047,29 +1217,44 @@ int read_dungeon(dungeon *d, char *file)
     exit(-1);
   }
 
-  fread(&d->PC->position[dim_x], 1, 1, f);
-  fread(&d->PC->position[dim_y], 1, 1, f);
-  
+  width = DUNGEON_X;
+  height = DUNGEON_Y;
+  if (version == DUNGEON_SAVE_VERSION_LARGE) {
+    fread(&width, sizeof (width), 1, f);
+    fread(&height, sizeof (height), 1, f);
+    width = be16toh(width);
+    height = be16toh(height);
+  }
+  resize_dungeon(d, width, height);
+
+  /* The PC may not exist yet when loading at startup. */
+  x = read_coordinate(f, version);
+  y = read_coordinate(f, version);
+  if (d->PC) {
+    d->PC->position[dim_x] = x;
+    d->PC->position[dim_y] = y;
+  }
+
   read_dungeon_map(d, f);
 
-  read_rooms(d, f);
+  read_rooms(d, f, version);
 
-  read_stairs(d, f);
+  read_stairs(d, f, version);
 
   fclose(f);
 
   return 0;
 }
 
-/* PGM dungeon descriptions do not support PC or stairs */
+/* PGM dungeon descriptions do not support PC or stairs.  The image is *
+ * the dungeon less its border, so it can be any size from 78x19 up.   */
 int read_pgm(dungeon *d, char *pgm)
 {
   FILE *f;
   char s[80];
-  uint8_t gm[DUNGEON_Y - 2][DUNGEON_X - 2];
   uint32_t x, y;
   uint32_t i;
-  char size[8]; /* Big enough to hold two 3-digit values with a space between. */
+  uint16_t width, height;
 
   if (!(f = fopen(pgm, "r"))) {
     perror(pgm);
@@ -1084,9 +1269,8 @@ int read_pgm(dungeon *d, char *pgm)
     fprintf(stderr, "Expected comment\n");
     exit(-1);
   }
-  snprintf(size, 8, "%d %d", DUNGEON_X - 2, DUNGEON_Y - 2);
-  if (!fgets(s, 80, f) || strncmp(s, size, 5)) {
-    fprintf(stderr, "Expected %s\n", size);
+  if (!fgets(s, 80, f) || sscanf(s, "%hu %hu", &width, &height) != 2) {
+    fprintf(stderr, "Expected image width and height\n");
     exit(-1);
   }
   if (!fgets(s, 80, f) || strncmp(s, "255", 2)) {
@@ -1094,7 +1278,10 @@ int read_pgm(dungeon *d, char *pgm)
     exit(-1);
   }
 
-  fread(gm, 1, (DUNGEON_X - 2) * (DUNGEON_Y - 2), f);
+  resize_dungeon(d, width + 2, height + 2);
+  grid<uint8_t> gm(width, height);
+
+  fread(gm.data(), 1, gm.size(), f);
 
   fclose(f);
 
@@ -1102,8 +1289,8 @@ int read_pgm(dungeon *d, char *pgm)
    * all other values as a hardness.  For simplicity, treat every white *
    * cell as its own room, so we have to count white after reading the  *
    * image in order to allocate the room array.                         */
-  for (d->num_rooms = 0, y = 0; y < DUNGEON_Y - 2; y++) {
-    for (x = 0; x < DUNGEON_X - 2; x++) {
+  for (d->num_rooms = 0, y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
       if (!gm[y][x]) {
         d->num_rooms++;
       }
@@ -1111,8 +1298,8 @@ int read_pgm(dungeon *d, char *pgm)
   }
   d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
 
-  for (i = 0, y = 0; y < DUNGEON_Y - 2; y++) {
-    for (x = 0; x < DUNGEON_X - 2; x++) {
+  for (i = 0, y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
       if (!gm[y][x]) {
         d->rooms[i].position[dim_x] = x + 1;
         d->rooms[i].position[dim_y] = y + 1;
@@ -1131,18 +1318,7 @@ int read_pgm(dungeon *d, char *pgm)
     }
   }
 
-  for (x = 0; x < DUNGEON_X; x++) {
-    d->map[0][x] = ter_wall_immutable;
-    d->hardness[0][x] = 255;
-    d->map[DUNGEON_Y - 1][x] = ter_wall_immutable;
-    d->hardness[DUNGEON_Y - 1][x] = 255;
-  }
-  for (y = 1; y < DUNGEON_Y - 1; y++) {
-    d->map[y][0] = ter_wall_immutable;
-    d->hardness[y][0] = 255;
-    d->map[y][DUNGEON_X - 1] = ter_wall_immutable;
-    d->hardness[y][DUNGEON_X - 1] = 255;
-  }
+  seal_border(d);
 
   return 0;
 }
@@ -1157,13 +1333,13 @@ void render_hardness_map(dungeon *d)
   
   putchar('\n');
   printf("   ");
-  for (i = 0; i < DUNGEON_X; i++) {
+  for (i = 0; i < d->width; i++) {
     printf("%2d", i);
   }
   putchar('\n');
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
+  for (p[dim_y] = 0; p[dim_y] < d->height; p[dim_y]++) {
     printf("%2d ", p[dim_y]);
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+    for (p[dim_x] = 0; p[dim_x] < d->width; p[dim_x]++) {
       printf("%02x", hardnesspair(p));
     }
     putchar('\n');
@@ -1175,8 +1351,8 @@ void render_movement_cost_map(dungeon *d)
   pair_t p;
 
   putchar('\n');
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+  for (p[dim_y] = 0; p[dim_y] < d->height; p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < d->width; p[dim_x]++) {
       if (p[dim_x] ==  d->PC->position[dim_x] &&
           p[dim_y] ==  d->PC->position[dim_y]) {
         putchar('@');
@@ -1196,8 +1372,8 @@ void render_distance_map(dungeon *d)
 {
   pair_t p;
 
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+  for (p[dim_y] = 0; p[dim_y] < d->height; p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < d->width; p[dim_x]++) {
       if (p[dim_x] ==  d->PC->position[dim_x] &&
           p[dim_y] ==  d->PC->position[dim_y]) {
         putchar('@');
@@ -1214,10 +1390,11 @@ void render_distance_map(dungeon *d)
         case ter_stairs_up:
         case ter_stairs_down:
           /* Placing X for infinity */
-          if (d->pc_distance[p[dim_y]][p[dim_x]] == UCHAR_MAX) {
+          if (d->pc_distance.get(p[dim_y], p[dim_x]) ==
+              d->pc_distance.infinity()) {
             putchar('X');
           } else {
-            putchar('0' + d->pc_distance[p[dim_y]][p[dim_x]] % 10);
+            putchar('0' + d->pc_distance.get(p[dim_y], p[dim_x]) % 10);
           }
           break;
         case ter_debug:
@@ -1237,8 +1414,8 @@ void render_tunnel_distance_map(dungeon *d)
 {
   pair_t p;
 
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+  for (p[dim_y] = 0; p[dim_y] < d->height; p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < d->width; p[dim_x]++) {
       if (p[dim_x] ==  d->PC->position[dim_x] &&
           p[dim_y] ==  d->PC->position[dim_y]) {
         putchar('@');
@@ -1255,10 +1432,11 @@ void render_tunnel_distance_map(dungeon *d)
         case ter_stairs_up:
         case ter_stairs_down:
           /* Placing X for infinity */
-          if (d->pc_tunnel[p[dim_y]][p[dim_x]] == UCHAR_MAX) {
+          if (d->pc_tunnel.get(p[dim_y], p[dim_x]) ==
+              d->pc_tunnel.infinity()) {
             putchar('X');
           } else {
-            putchar('0' + d->pc_tunnel[p[dim_y]][p[dim_x]] % 10);
+            putchar('0' + d->pc_tunnel.get(p[dim_y], p[dim_x]) % 10);
           }
           break;
         case ter_debug:
@@ -1299,3 +1477,357 @@ void new_dungeon(dungeon *d, int a)
   
   gen_objects(d);
 }
+
+#ifdef BENCHMARK
+
+/* Times smooth_hardness() against the implementation it replaced, which *
+ * diffused through a malloc()ed linked list and convolved twice with    *
+ * bounds checks, and checks that both give identical hardness maps for  *
+ * every seed.  Then times whole dungeons, with the old and new room     *
+ * placement, and reports how hard placement had to work.  Build with:   *
+ *   make && g++ -O2 -DBENCHMARK -DTERM='"S2021"' -c dungeon.cpp -o b.o  *
+ *   g++ b.o $(ls *.o | grep -v -e rlg327.o -e dungeon.o) -lncurses      *
+ * and run with an optional number of seeds.                             */
+
+# include <ctime>
+
+typedef struct queue_node {
+  int x, y;
+  struct queue_node *next;
+} queue_node_t;
+
+static int smooth_hardness_reference(dungeon *d)
+{
+  int32_t i, x, y;
+  int32_t s, t, p, q;
+  queue_node_t *head, *tail, *tmp;
+  uint8_t hardness[DUNGEON_Y][DUNGEON_X];
+
+  memset(&hardness, 0, sizeof (hardness));
+
+  /* Seed with some values */
+  for (i = 1; i < 255; i += 20) {
+    do {
+      x = d->map_rng.under(DUNGEON_X);
+      y = d->map_rng.under(DUNGEON_Y);
+    } while (hardness[y][x]);
+    hardness[y][x] = i;
+    if (i == 1) {
+      head = tail = (queue_node_t *) malloc(sizeof (*tail));
+    } else {
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+    }
+    tail->next = NULL;
+    tail->x = x;
+    tail->y = y;
+  }
+
+  /* Diffuse the vaules to fill the space */
+  while (head) {
+    x = head->x;
+    y = head->y;
+    i = hardness[y][x];
+
+    if (x - 1 >= 0 && y - 1 >= 0 && !hardness[y - 1][x - 1]) {
+      hardness[y - 1][x - 1] = i;
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+      tail->next = NULL;
+      tail->x = x - 1;
+      tail->y = y - 1;
+    }
+    if (x - 1 >= 0 && !hardness[y][x - 1]) {
+      hardness[y][x - 1] = i;
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+      tail->next = NULL;
+      tail->x = x - 1;
+      tail->y = y;
+    }
+    if (x - 1 >= 0 && y + 1 < DUNGEON_Y && !hardness[y + 1][x - 1]) {
+      hardness[y + 1][x - 1] = i;
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+      tail->next = NULL;
+      tail->x = x - 1;
+      tail->y = y + 1;
+    }
+    if (y - 1 >= 0 && !hardness[y - 1][x]) {
+      hardness[y - 1][x] = i;
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+      tail->next = NULL;
+      tail->x = x;
+      tail->y = y - 1;
+    }
+    if (y + 1 < DUNGEON_Y && !hardness[y + 1][x]) {
+      hardness[y + 1][x] = i;
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+      tail->next = NULL;
+      tail->x = x;
+      tail->y = y + 1;
+    }
+    if (x + 1 < DUNGEON_X && y - 1 >= 0 && !hardness[y - 1][x + 1]) {
+      hardness[y - 1][x + 1] = i;
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+      tail->next = NULL;
+      tail->x = x + 1;
+      tail->y = y - 1;
+    }
+    if (x + 1 < DUNGEON_X && !hardness[y][x + 1]) {
+      hardness[y][x + 1] = i;
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+      tail->next = NULL;
+      tail->x = x + 1;
+      tail->y = y;
+    }
+    if (x + 1 < DUNGEON_X && y + 1 < DUNGEON_Y && !hardness[y + 1][x + 1]) {
+      hardness[y + 1][x + 1] = i;
+      tail->next = (queue_node_t *) malloc(sizeof (*tail));
+      tail = tail->next;
+      tail->next = NULL;
+      tail->x = x + 1;
+      tail->y = y + 1;
+    }
+
+    tmp = head;
+    head = head->next;
+    free(tmp);
+  }
+
+  /* And smooth it a bit with a gaussian convolution */
+  for (y = 0; y < DUNGEON_Y; y++) {
+    for (x = 0; x < DUNGEON_X; x++) {
+      for (s = t = p = 0; p < 5; p++) {
+        for (q = 0; q < 5; q++) {
+          if (y + (p - 2) >= 0 && y + (p - 2) < DUNGEON_Y &&
+              x + (q - 2) >= 0 && x + (q - 2) < DUNGEON_X) {
+            s += gaussian[p][q];
+            t += hardness[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
+          }
+        }
+      }
+      d->hardness[y][x] = t / s;
+    }
+  }
+  /* Let's do it again, until it's smooth like Kenny G. */
+  for (y = 0; y < DUNGEON_Y; y++) {
+    for (x = 0; x < DUNGEON_X; x++) {
+      for (s = t = p = 0; p < 5; p++) {
+        for (q = 0; q < 5; q++) {
+          if (y + (p - 2) >= 0 && y + (p - 2) < DUNGEON_Y &&
+              x + (q - 2) >= 0 && x + (q - 2) < DUNGEON_X) {
+            s += gaussian[p][q];
+            t += hardness[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
+          }
+        }
+      }
+      d->hardness[y][x] = t / s;
+    }
+  }
+
+
+  return 0;
+}
+
+/* The old room placement, which threw away the whole map--and reran *
+ * smooth_hardness()--whenever any room overlapped.                  */
+static uint32_t reference_restarts;
+
+static int place_rooms_reference(dungeon *d)
+{
+  pair_t p;
+  uint32_t i;
+  int success;
+  room_t *r;
+
+  for (success = 0; !success; ) {
+    success = 1;
+    for (i = 0; success && i < d->num_rooms; i++) {
+      r = d->rooms + i;
+      r->position[dim_x] = 1 + d->map_rng.under(d->width - 2 -
+                                                r->size[dim_x]);
+      r->position[dim_y] = 1 + d->map_rng.under(d->height - 2 -
+                                                r->size[dim_y]);
+      for (p[dim_y] = r->position[dim_y] - 1;
+           success && p[dim_y] < r->position[dim_y] + r->size[dim_y] + 1;
+           p[dim_y]++) {
+        for (p[dim_x] = r->position[dim_x] - 1;
+             success && p[dim_x] < r->position[dim_x] + r->size[dim_x] + 1;
+             p[dim_x]++) {
+          if (mappair(p) >= ter_floor) {
+            success = 0;
+            reference_restarts++;
+            empty_dungeon(d);
+          } else if ((p[dim_y] != r->position[dim_y] - 1)              &&
+                     (p[dim_y] != r->position[dim_y] + r->size[dim_y]) &&
+                     (p[dim_x] != r->position[dim_x] - 1)              &&
+                     (p[dim_x] != r->position[dim_x] + r->size[dim_x])) {
+            mappair(p) = ter_floor_room;
+            hardnesspair(p) = 0;
+          }
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+static void gen_dungeon_reference(dungeon *d)
+{
+  empty_dungeon(d);
+  make_rooms(d);
+  place_rooms_reference(d);
+  connect_rooms(d);
+  place_stairs(d);
+  place_store(d);
+}
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Generates dungeons of each size, and times generation and both  *
+ * distance maps from a PC in the first room.  Per-cell times that *
+ * stay flat mean the work grows linearly with the map.            */
+static void bench_sizes(uint32_t seeds)
+{
+  static const uint16_t sizes[][2] = {
+    {   80,   21 },
+    {  160,   42 },
+    {  320,   84 },
+    {  640,  168 },
+    { 1024, 1024 },
+  };
+  dungeon *d;
+  double start, gen_time, dist_time, tunnel_time, cells;
+  uint32_t i, seed, runs;
+
+  printf("size        dungeons  gen ms   dist ms  tunnel ms"
+         "  gen ns/cell  dist ns/cell  tunnel ns/cell\n");
+  for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++) {
+    d = new dungeon;
+    resize_dungeon(d, sizes[i][0], sizes[i][1]);
+    runs = seeds / (100 * dungeon_scale(d));
+    if (!runs) {
+      runs = 1;
+    }
+    d->PC = new pc;
+    gen_time = dist_time = tunnel_time = 0.0;
+    for (seed = 0; seed < runs; seed++) {
+      seed_dungeon(d, seed);
+      start = bench_now();
+      gen_dungeon(d);
+      gen_time += bench_now() - start;
+
+      d->PC->position[dim_y] = d->rooms->position[dim_y];
+      d->PC->position[dim_x] = d->rooms->position[dim_x];
+      start = bench_now();
+      dijkstra(d);
+      dist_time += bench_now() - start;
+      start = bench_now();
+      dijkstra_tunnel(d);
+      tunnel_time += bench_now() - start;
+      free(d->rooms);
+    }
+    cells = (double) sizes[i][0] * sizes[i][1] * runs;
+    printf("%4ux%-4u  %9u  %7.3f  %8.3f  %9.3f  %11.1f  %12.1f  %14.1f\n",
+           sizes[i][0], sizes[i][1], runs,
+           gen_time * 1000 / runs, dist_time * 1000 / runs,
+           tunnel_time * 1000 / runs, gen_time * 1e9 / cells,
+           dist_time * 1e9 / cells, tunnel_time * 1e9 / cells);
+    delete d->PC;
+    delete d;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  dungeon *d;
+  grid<uint8_t> reference;
+  double start, reference_time, smooth_time;
+  double gen_reference_time, gen_time;
+  uint64_t attempts, retries, restarts;
+  uint32_t seed, seeds;
+
+  seeds = argc > 1 ? atoi(argv[1]) : 10000;
+  d = new dungeon;
+
+  for (seed = 0; seed < seeds; seed++) {
+    seed_dungeon(d, seed);
+    smooth_hardness_reference(d);
+    reference = d->hardness;
+    seed_dungeon(d, seed);
+    smooth_hardness(d);
+    if (reference != d->hardness) {
+      fprintf(stderr, "Seed %u: hardness maps differ!\n", seed);
+      return 1;
+    }
+  }
+
+  start = bench_now();
+  for (seed = 0; seed < seeds; seed++) {
+    seed_dungeon(d, seed);
+    smooth_hardness_reference(d);
+  }
+  reference_time = bench_now() - start;
+
+  start = bench_now();
+  for (seed = 0; seed < seeds; seed++) {
+    seed_dungeon(d, seed);
+    smooth_hardness(d);
+  }
+  smooth_time = bench_now() - start;
+
+  reference_restarts = 0;
+  start = bench_now();
+  for (seed = 0; seed < seeds; seed++) {
+    seed_dungeon(d, seed);
+    gen_dungeon_reference(d);
+    free(d->rooms);
+  }
+  gen_reference_time = bench_now() - start;
+
+  attempts = retries = restarts = 0;
+  start = bench_now();
+  for (seed = 0; seed < seeds; seed++) {
+    seed_dungeon(d, seed);
+    gen_dungeon(d);
+    free(d->rooms);
+    attempts += d->room_attempts;
+    retries += d->room_retries;
+    restarts += d->gen_restarts;
+  }
+  gen_time = bench_now() - start;
+
+  printf("%u seeds, identical hardness maps\n", seeds);
+  printf("smooth_hardness  old %8.2f us  new %8.2f us  %6.2fx\n",
+         reference_time * 1000000 / seeds, smooth_time * 1000000 / seeds,
+         reference_time / smooth_time);
+  printf("gen_dungeon      old %8.3f ms  new %8.3f ms  %6.2fx\n",
+         gen_reference_time * 1000 / seeds, gen_time * 1000 / seeds,
+         gen_reference_time / gen_time);
+  printf("old placement: %.2f map rebuilds per dungeon\n",
+         (double) reference_restarts / seeds);
+  printf("new placement: %.2f attempts, %.2f retries, %.4f restarts "
+         "per dungeon\n", (double) attempts / seeds,
+         (double) retries / seeds, (double) restarts / seeds);
+
+  delete d;
+
+  bench_sizes(seeds);
+
+  return 0;
+}
+
+#endif
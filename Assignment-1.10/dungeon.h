@@ -4,12 +4,26 @@
 # include <vector>
 
 # include "heap.h"
+# include "bucket.h"
+# include "event.h"
 # include "dims.h"
 # include "character.h"
+# include "npc.h"
 # include "descriptions.h"
+# include "rng.h"
+# include "grid.h"
+# include "bitmap.h"
+# include "registry.h"
+# include "distance.h"
+# include "path.h"
 
+/* The default dungeon size, which is also the smallest allowed, since *
+ * it's the size of the map area of the screen.  Bigger dungeons       *
+ * scroll.  The largest is limited by memory more than anything else.  */
 #define DUNGEON_X              80
 #define DUNGEON_Y              21
+#define DUNGEON_MAX_X          4096
+#define DUNGEON_MAX_Y          4096
 #define MIN_ROOMS              6
 #define MAX_ROOMS              10
 #define ROOM_MIN_X             4
@@ -27,6 +41,7 @@
 #define DUNGEON_SAVE_FILE      "dungeon"
 #define DUNGEON_SAVE_SEMANTIC  "RLG327-" TERM
 #define DUNGEON_SAVE_VERSION   0U
+#define DUNGEON_SAVE_VERSION_LARGE 1U
 #define MONSTER_DESC_FILE      "monster_desc.txt"
 #define OBJECT_DESC_FILE       "object_desc.txt"
 #define MAX_INVENTORY          10
@@ -35,6 +50,9 @@
 #define mapxy(x, y) (d->map[y][x])
 #define hardnesspair(pair) (d->hardness[pair[dim_y]][pair[dim_x]])
 #define hardnessxy(x, y) (d->hardness[y][x])
+#define walkablexy(x, y) (d->walkable.get(y, x))
+#define walkablepair(pair) (d->walkable.get(pair[dim_y], pair[dim_x]))
+#define immutablepair(pair) (d->immutable.get(pair[dim_y], pair[dim_x]))
 #define charpair(pair) (d->character_map[pair[dim_y]][pair[dim_x]])
 #define charxy(x, y) (d->character_map[y][x])
 #define objpair(pair) (d->objmap[pair[dim_y]][pair[dim_x]])
@@ -64,14 +82,45 @@ class object;
 
 class dungeon {
  public:
-  dungeon() : num_rooms(0), rooms(0), map{ter_wall}, hardness{0},
-              pc_distance{0}, pc_tunnel{0}, character_map{0}, PC(0),
-              num_monsters(0), max_monsters(0), character_sequence_number(0),
-              time(0), is_new(0), quit(0), monster_descriptions(),
+  dungeon() : num_rooms(0), rooms(0), width(DUNGEON_X), height(DUNGEON_Y),
+              map(DUNGEON_X, DUNGEON_Y, ter_wall),
+              hardness(DUNGEON_X, DUNGEON_Y),
+              walkable(DUNGEON_X, DUNGEON_Y), immutable(DUNGEON_X, DUNGEON_Y),
+              layers_terrain_generation(0),
+              pc_distance(DUNGEON_X, DUNGEON_Y),
+              pc_tunnel(DUNGEON_X, DUNGEON_Y), hunt_walk(), hunt_tunnel(),
+              character_map(DUNGEON_X, DUNGEON_Y),
+              monsters(DUNGEON_X, DUNGEON_Y),
+              objmap(DUNGEON_X, DUNGEON_Y), PC(0), pc_event(),
+              event_allocations(0), batch(), num_monsters(0), max_monsters(0),
+              character_sequence_number(0),
+              time(0), is_new(0), quit(0), pc_generation(0),
+              terrain_generation(0), path_pc_generation(0),
+              path_terrain_generation(0), path_requests(0),
+              path_recomputes(0), path_repairs(0), path_nsec(0),
+              num_events(0), num_batches(0), path_cache_kb(PATH_CACHE_KB),
+              path_pc_position(), path_cache(), path_cache_tick(0),
+              path_cache_hits(0), path_cache_misses(0),
+              path_frontier(), path_queue(),
+              path_repair_queue(),
+              los_position(), los_terrain_generation(0),
+              los_known{bitmap(DUNGEON_X, DUNGEON_Y),
+                        bitmap(DUNGEON_X, DUNGEON_Y)},
+              los_seen{bitmap(DUNGEON_X, DUNGEON_Y),
+                       bitmap(DUNGEON_X, DUNGEON_Y)},
+              los_queries(0), los_walks(0), ai_threads(0), ai_pool(0),
+              plans(), plan_runs(),
+              planning(0), planned_moves(0), replanned_moves(0),
+              autopilot_seen_corner(0), autopilot_corner_turns(0),
+              room_attempts(0), room_retries(0),
+              gen_restarts(0), monster_descriptions(),
               object_descriptions() {}
   uint32_t num_rooms;
   room_t *rooms;
-  terrain_type map[DUNGEON_Y][DUNGEON_X];
+  /* Set by resize_dungeon(), along with the size of every map below. */
+  uint16_t width;
+  uint16_t height;
+  grid<terrain_type> map;
   /* Since hardness is usually not used, it would be expensive to pull it *
    * into cache every time we need a map cell, so we store it in a        *
    * parallel array, rather than using a structure to represent the       *
@@ -80,13 +129,34 @@ class dungeon {
    * that structure.  Pathfinding will require efficient use of the map,  *
    * and pulling in unnecessary data with each map cell would add a lot   *
    * of overhead to the memory system.                                    */
-  uint8_t hardness[DUNGEON_Y][DUNGEON_X];
-  uint8_t pc_distance[DUNGEON_Y][DUNGEON_X];
-  uint8_t pc_tunnel[DUNGEON_Y][DUNGEON_X];
-  character *character_map[DUNGEON_Y][DUNGEON_X];
-  object *objmap[DUNGEON_Y][DUNGEON_X];
+  grid<uint8_t> hardness;
+  /* Bit layers over map: walkable is map >= ter_floor, immutable is   *
+   * map == ter_wall_immutable.  They're rebuilt from map when stale,  *
+   * like the distance maps, and patched in place by                   *
+   * path_terrain_changed(); call terrain_layers_update() before       *
+   * reading them.                                                     */
+  bitmap walkable;
+  bitmap immutable;
+  uint32_t layers_terrain_generation;
+  distance_map pc_distance;
+  distance_map pc_tunnel;
+  /* Distances to where each hunting monster last saw the PC; see *
+   * npc_next_pos_hunt().                                         */
+  goal_map_t hunt_walk;
+  goal_map_t hunt_tunnel;
+  grid<character *> character_map;
+  monster_registry monsters;
+  grid<object *> objmap;
   pc *PC;
-  heap_t events;
+  event_queue_t events;
+  /* The PC's turn, re-keyed and put back on the queue by every       *
+   * do_moves(), and the number of events ever malloc()ed; the rest   *
+   * are reused, so once a level is populated this stops growing.     */
+  event pc_event;
+  uint32_t event_allocations;
+  /* The events do_moves() has taken off the queue together, all due *
+   * at the same time.                                               */
+  std::vector<event *> batch;
   uint16_t num_monsters;
   uint16_t max_monsters;
   uint16_t num_objects;
@@ -100,11 +170,93 @@ class dungeon {
   uint32_t time;
   uint32_t is_new;
   uint32_t quit;
+  /* The distance maps depend on the PC's position and on the terrain.  *
+   * Each has a generation counter, bumped whenever it changes, and the *
+   * maps remember the generations they were built from, so they are    *
+   * only rebuilt when somebody reads them after a change.  See         *
+   * path_update().  path_requests counts the changes that used to      *
+   * force an immediate rebuild, so the rebuilds saved are              *
+   * path_requests - path_recomputes.                                   */
+  uint32_t pc_generation;
+  uint32_t terrain_generation;
+  uint32_t path_pc_generation;
+  uint32_t path_terrain_generation;
+  uint32_t path_requests;
+  uint32_t path_recomputes;
+  uint32_t path_repairs;
+  /* Wall-clock time spent rebuilding and repairing the distance maps, *
+   * and the number of events taken off the queue, and in how many     *
+   * batches, for --headless.                                          */
+  uint64_t path_nsec;
+  uint32_t num_events;
+  uint32_t num_batches;
+  /* Recently used distance maps, for a PC pacing back and forth over *
+   * the same few cells.  Sized by path_cache_kb, zero to disable.    */
+  uint32_t path_cache_kb;
+  pair_t path_pc_position;
+  std::vector<path_cache_entry_t> path_cache;
+  uint32_t path_cache_tick;
+  uint32_t path_cache_hits;
+  uint32_t path_cache_misses;
+  /* Scratch space for the searches in path.cpp: the walking searches' *
+   * frontier, the tunneling searches' queue, and dijkstra_repair()'s  *
+   * queue.  The first two grow to fit the biggest map so far, and     *
+   * delete_dungeon() frees the tunneling queue.  None are statics, so *
+   * that several dungeons can be simulated at once.                   */
+  std::vector<uint32_t> path_frontier;
+  bucket_queue_t path_queue;
+  repair_queue_t path_repair_queue;
+  /* can_see()'s memory of lines to (los_known/seen[0]) and from ([1]) *
+   * the PC at los_position.  Of los_queries calls, los_walks had to   *
+   * draw the line; the rest were answered from here.                  */
+  pair_t los_position;
+  uint32_t los_terrain_generation;
+  bitmap los_known[2];
+  bitmap los_seen[2];
+  uint32_t los_queries;
+  uint32_t los_walks;
+  /* Threads to plan monsters' moves on, or zero to have each monster  *
+   * decide as it moves; see npc_plan_moves().  planning is set while  *
+   * plans are being made.  Of the planned_moves, replanned_moves had  *
+   * to be decided again, because the monster was pushed first.        *
+   * The plans belong to this dungeon alone, and npc::plan points into *
+   * them, so another dungeon planning at the same time can't disturb  *
+   * them.                                                             */
+  uint32_t ai_threads;
+  struct work_pool *ai_pool;
+  std::vector<npc_plan_t> plans;
+  std::vector<npc_plan_run_t> plan_runs;
+  uint32_t planning;
+  uint32_t planned_moves;
+  uint32_t replanned_moves;
+  /* Independent random streams, all derived from the game seed by     *
+   * seed_dungeon().  Keeping them apart means, e.g., that a change to *
+   * monster AI doesn't change the dungeons or the loot.               */
+  rng map_rng;       /* Dungeon generation and monster placement */
+  rng ai_rng;        /* Monster movement                         */
+  rng combat_rng;    /* Damage rolls                             */
+  rng loot_rng;      /* Objects and store stock                  */
+  rng autopilot_rng; /* pc_next_pos() playing the PC             */
+  /* The rest of pc_next_pos()'s memory: whether it has reached a    *
+   * corner yet, and the turns since it first did.  Like its stream, *
+   * it belongs to one game, and seed_dungeon() starts it over.      */
+  uint32_t autopilot_seen_corner;
+  uint32_t autopilot_corner_turns;
+  /* Statistics from the last gen_dungeon(): positions tried for rooms, *
+   * how many of those overlapped something, and how many times too     *
+   * many rooms failed to fit and generation started over.              */
+  uint32_t room_attempts;
+  uint32_t room_retries;
+  uint32_t gen_restarts;
   std::vector<monster_description> monster_descriptions;
   std::vector<object_description> object_descriptions;
 };
 
 void init_dungeon(dungeon *d);
+void terrain_layers_rebuild(dungeon *d);
+void terrain_layers_set(dungeon *d, pair_t *cells, uint32_t num_cells);
+void resize_dungeon(dungeon *d, uint16_t width, uint16_t height);
+void seed_dungeon(dungeon *d, uint32_t seed);
 void new_dungeon(dungeon *d, int a);
 void delete_dungeon(dungeon *d);
 int gen_dungeon(dungeon *d);
@@ -117,4 +269,11 @@ void render_tunnel_distance_map(dungeon *d);
 void init_dungeon(dungeon *d);
 void pc_see_object(character *the_pc, object *o);
 
+static inline void terrain_layers_update(dungeon *d)
+{
+  if (d->layers_terrain_generation != d->terrain_generation) {
+    terrain_layers_rebuild(d);
+  }
+}
+
 #endif
@@ -1,6 +1,9 @@
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 
 #include "event.h"
+#include "dungeon.h"
 #include "character.h"
 
 static uint32_t next_event_number(void)
@@ -28,7 +31,12 @@ event *new_event(dungeon *d, eventype_t t, void *v, uint32_t delay)
 {
   event *e;
 
-  e = (event *) malloc(sizeof (*e));
+  if ((e = d->events.spare)) {
+    d->events.spare = e->next;
+  } else {
+    e = (event *) malloc(sizeof (*e));
+    d->event_allocations++;
+  }
 
   e->type = t;
   e->time = d->time + delay;
@@ -49,7 +57,9 @@ event *update_event(dungeon *d, event *e, uint32_t delay)
   return e;
 }
 
-void event_delete(void *v)
+/* The PC's turn is the dungeon's own event, d->pc_event, the only one *
+ * with sequence 0.  It's re-keyed every turn and never freed.         */
+static void event_free(void *v)
 {
   event *e = (event *) v;
 
@@ -59,5 +69,292 @@ void event_delete(void *v)
     break;
   }
 
-  free(e);
+  if (e->sequence) {
+    free(e);
+  }
+}
+
+void event_delete(dungeon *d, event *e)
+{
+  switch (e->type) {
+  case event_character_turn:
+    character_delete(e->c);
+    break;
+  }
+
+  if (e->sequence) {
+    e->next = d->events.spare;
+    d->events.spare = e;
+  }
+}
+
+void event_queue_init(event_queue_t *q)
+{
+  memset(q->head, 0, sizeof (q->head));
+  memset(q->tail, 0, sizeof (q->tail));
+  memset(q->occupied, 0, sizeof (q->occupied));
+  q->now = 0;
+  q->on_wheel = 0;
+  heap_init(&q->overflow, compare_events, event_free);
+  q->spare = NULL;
+}
+
+void event_queue_delete(event_queue_t *q)
+{
+  uint32_t i;
+  event *e;
+
+  for (i = 0; i < EVENT_WHEEL_SLOTS; i++) {
+    while ((e = q->head[i])) {
+      q->head[i] = e->next;
+      event_free(e);
+    }
+  }
+  while ((e = q->spare)) {
+    q->spare = e->next;
+    free(e);
+  }
+  heap_delete(&q->overflow);
+  event_queue_init(q);
+}
+
+void event_queue_insert(event_queue_t *q, event *e)
+{
+  uint32_t slot;
+  event **p;
+
+  if (!q->on_wheel) {
+    q->now = e->time;
+  }
+  /* Unsigned, so this also sends anything earlier than now to the heap. */
+  if (e->time - q->now >= EVENT_WHEEL_SLOTS) {
+    heap_insert(&q->overflow, e);
+    return;
+  }
+
+  slot = e->time & (EVENT_WHEEL_SLOTS - 1);
+  if (!q->head[slot] || q->tail[slot]->sequence < e->sequence) {
+    /* The usual case: the newest sequence number goes last. */
+    e->next = NULL;
+    if (q->head[slot]) {
+      q->tail[slot]->next = e;
+    } else {
+      q->head[slot] = e;
+      q->occupied[slot >> 6] |= 1ULL << (slot & 63);
+    }
+    q->tail[slot] = e;
+  } else {
+    /* The PC's turns are sequence 0, and go first. */
+    p = &q->head[slot];
+    while ((*p)->sequence < e->sequence) {
+      p = &(*p)->next;
+    }
+    e->next = *p;
+    *p = e;
+  }
+  q->on_wheel++;
+}
+
+/* The first slot in use at or after now's, as a distance from now. */
+static uint32_t next_occupied(const event_queue_t *q)
+{
+  uint32_t start, word;
+  uint64_t bits;
+
+  start = q->now & (EVENT_WHEEL_SLOTS - 1);
+  word = start >> 6;
+  bits = q->occupied[word] & (~0ULL << (start & 63));
+  while (!bits) {
+    word = (word + 1) % (EVENT_WHEEL_SLOTS / 64);
+    bits = q->occupied[word];
+  }
+
+  return (((word << 6) + __builtin_ctzll(bits) - start) &
+          (EVENT_WHEEL_SLOTS - 1));
 }
+
+event *event_queue_remove_min(event_queue_t *q)
+{
+  uint32_t slot;
+  event *e, *h;
+
+  h = (event *) heap_peek_min(&q->overflow);
+  if (!q->on_wheel) {
+    return h ? (event *) heap_remove_min(&q->overflow) : NULL;
+  }
+
+  q->now += next_occupied(q);
+  slot = q->now & (EVENT_WHEEL_SLOTS - 1);
+  e = q->head[slot];
+  if (h && compare_events(h, e) < 0) {
+    return (event *) heap_remove_min(&q->overflow);
+  }
+
+  if (!(q->head[slot] = e->next)) {
+    q->occupied[slot >> 6] &= ~(1ULL << (slot & 63));
+  }
+  q->on_wheel--;
+
+  return e;
+}
+
+static bool event_before(const event *e1, const event *e2)
+{
+  return compare_events(e1, e2) < 0;
+}
+
+uint32_t event_queue_remove_slice(event_queue_t *q,
+                                  std::vector<event *> &slice)
+{
+  uint32_t slot, n;
+  event *e, *h;
+
+  slice.clear();
+
+  h = (event *) heap_peek_min(&q->overflow);
+  if (q->on_wheel) {
+    q->now += next_occupied(q);
+    if (!h || (int32_t) (h->time - q->now) >= 0) {
+      slot = q->now & (EVENT_WHEEL_SLOTS - 1);
+      for (e = q->head[slot]; e; e = e->next) {
+        slice.push_back(e);
+      }
+      q->head[slot] = NULL;
+      q->occupied[slot >> 6] &= ~(1ULL << (slot & 63));
+      q->on_wheel -= slice.size();
+    }
+  }
+
+  n = slice.size();
+  while ((h = (event *) heap_peek_min(&q->overflow)) &&
+         (slice.empty() || h->time == slice[0]->time)) {
+    slice.push_back((event *) heap_remove_min(&q->overflow));
+  }
+  if (n && slice.size() > n) {
+    /* The same time on the wheel and in the heap; hardly ever happens. */
+    std::inplace_merge(slice.begin(), slice.begin() + n, slice.end(),
+                       event_before);
+  }
+
+  return slice.size();
+}
+
+uint32_t event_queue_size(const event_queue_t *q)
+{
+  return q->on_wheel + q->overflow.size;
+}
+
+#ifdef BENCHMARK
+
+/* Times the event queue against the Fibonacci heap it replaced, with  *
+ * the same load as do_moves(): n monsters of speeds 5 to 20 (and a PC *
+ * at 10) each taking a turn and going back in 1000 / speed later.     *
+ * Checks that both hand out the turns in exactly the same order.      *
+ * Build with:                                                         *
+ *   make && g++ -O2 -DBENCHMARK -DTERM='"S2021"' -c event.cpp -o b.o  *
+ *   g++ b.o $(ls *.o | grep -v -e rlg327.o -e event.o) -lncurses      *
+ * and run with optional monster counts.                               */
+
+# include <cstdio>
+# include <ctime>
+
+static double bench_seconds(struct timespec *start)
+{
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return ((end.tv_sec - start->tv_sec) +
+          (end.tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+int main(int argc, char *argv[])
+{
+  static const uint32_t default_counts[] = { 10, 100, 300, 1000, 3000 };
+  const uint32_t turns = 2000000;
+  uint32_t counts[16], num_counts;
+  event *heap_events, *wheel_events, *e;
+  uint32_t *heap_order, *speed;
+  heap_t h;
+  event_queue_t *q;
+  struct timespec start;
+  double heap_time, wheel_time;
+  uint32_t i, n, c, sequence;
+  rng r;
+
+  for (num_counts = 0; (int) num_counts + 1 < argc && num_counts < 16;
+       num_counts++) {
+    counts[num_counts] = atoi(argv[num_counts + 1]);
+  }
+  if (!num_counts) {
+    num_counts = sizeof (default_counts) / sizeof (default_counts[0]);
+    memcpy(counts, default_counts, sizeof (default_counts));
+  }
+
+  q = (event_queue_t *) malloc(sizeof (*q));
+  heap_order = (uint32_t *) malloc(turns * sizeof (*heap_order));
+
+  printf("%8s %10s %10s %8s\n", "monsters", "heap ns", "wheel ns", "speedup");
+  for (c = 0; c < num_counts; c++) {
+    n = counts[c] + 1;
+    heap_events = (event *) calloc(n, sizeof (*heap_events));
+    wheel_events = (event *) calloc(n, sizeof (*wheel_events));
+    speed = (uint32_t *) malloc(n * sizeof (*speed));
+    r.seed(c, 0);
+    for (i = 0; i < n; i++) {
+      speed[i] = i ? r.range(5, 20) : 10;
+      heap_events[i].time = wheel_events[i].time = 0;
+      heap_events[i].sequence = wheel_events[i].sequence = i;
+      heap_events[i].c = wheel_events[i].c = (character *) (uintptr_t) i;
+    }
+
+    heap_init(&h, compare_events, NULL);
+    for (i = 0; i < n; i++) {
+      heap_insert(&h, heap_events + i);
+    }
+    sequence = n;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < turns; i++) {
+      e = (event *) heap_remove_min(&h);
+      heap_order[i] = (uintptr_t) e->c;
+      e->time += 1000 / speed[(uintptr_t) e->c];
+      e->sequence = sequence++;
+      heap_insert(&h, e);
+    }
+    heap_time = bench_seconds(&start);
+    heap_delete(&h);
+
+    event_queue_init(q);
+    for (i = 0; i < n; i++) {
+      event_queue_insert(q, wheel_events + i);
+    }
+    sequence = n;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < turns; i++) {
+      e = event_queue_remove_min(q);
+      if (heap_order[i] != (uintptr_t) e->c) {
+        fprintf(stderr, "%u monsters: turn %u differs!\n", n - 1, i);
+        return 1;
+      }
+      e->time += 1000 / speed[(uintptr_t) e->c];
+      e->sequence = sequence++;
+      event_queue_insert(q, e);
+    }
+    wheel_time = bench_seconds(&start);
+
+    printf("%8u %10.1f %10.1f %7.2fx\n", n - 1,
+           heap_time * 1000000000 / turns, wheel_time * 1000000000 / turns,
+           heap_time / wheel_time);
+
+    free(heap_events);
+    free(wheel_events);
+    free(speed);
+  }
+
+  free(heap_order);
+  free(q);
+
+  return 0;
+}
+
+#endif
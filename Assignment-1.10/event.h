@@ -2,8 +2,12 @@
 # define EVENT_H
 
 # include <stdint.h>
+# include <vector>
 
-# include "dungeon.h"
+# include "heap.h"
+
+class dungeon;
+class character;
 
 typedef enum eventype {
   event_character_turn,
@@ -16,11 +20,50 @@ struct event {
   union {
     character *c;
   };
+  /* The next event in the same slot of an event_queue's wheel. */
+  event *next;
 };
 
+/* The game's event queue, ordered by (time, sequence) like              *
+ * compare_events().  Every delay in the game is 1000 / speed, at most   *
+ * 1000, so nearly every event lands within EVENT_WHEEL_SLOTS ticks of   *
+ * the earliest one.  Those go on a timing wheel: a slot per tick, each  *
+ * a list kept in sequence order (which is almost always insertion       *
+ * order, so it's appended to), and a bitmap of the slots in use to find *
+ * the next one.  Inserting and removing the minimum are both O(1).      *
+ * Anything outside the wheel's window goes to a heap, and the minimum   *
+ * is whichever of the two is earlier, so any time at all is handled     *
+ * correctly--just not as quickly.                                       */
+# define EVENT_WHEEL_SLOTS 1024
+
+typedef struct event_queue {
+  event *head[EVENT_WHEEL_SLOTS];
+  event *tail[EVENT_WHEEL_SLOTS];
+  uint64_t occupied[EVENT_WHEEL_SLOTS / 64];
+  /* No event on the wheel is earlier than now. */
+  uint32_t now;
+  uint32_t on_wheel;
+  heap_t overflow;
+  /* Deleted events, kept for new_event() to reuse. */
+  event *spare;
+} event_queue_t;
+
 int32_t compare_events(const void *event1, const void *event2);
 event *new_event(dungeon *d, eventype_t t, void *v, uint32_t delay);
 event *update_event(dungeon *d, event *e, uint32_t delay);
-void event_delete(void *e);
+/* Deletes e's character, and keeps e for reuse. */
+void event_delete(dungeon *d, event *e);
+
+void event_queue_init(event_queue_t *q);
+/* Deletes everything still in the queue, characters included. */
+void event_queue_delete(event_queue_t *q);
+void event_queue_insert(event_queue_t *q, event *e);
+event *event_queue_remove_min(event_queue_t *q);
+/* Removes the earliest event and every other one at the same time,    *
+ * into slice in (time, sequence) order, and returns how many.  On the *
+ * wheel, that's a whole slot at once.                                 */
+uint32_t event_queue_remove_slice(event_queue_t *q,
+                                  std::vector<event *> &slice);
+uint32_t event_queue_size(const event_queue_t *q);
 
 #endif
@@ -0,0 +1,112 @@
+#ifndef GRID_H
+# define GRID_H
+
+# include <stdint.h>
+# include <algorithm>
+
+/* A two-dimensional array with its dimensions chosen at run time.  The *
+ * cells are one contiguous block, row-major, so g[y] is an ordinary    *
+ * pointer to row y and g[y][x] reads exactly like the fixed-size       *
+ * arrays this replaced.  Code that wants a flat index can use          *
+ * y * width() + x into data().                                         *
+ *                                                                      *
+ * Rows are at most 65535 cells wide, so a width or height promotes to  *
+ * int, and comparing one against a loop counter of any type is safe.   *
+ *                                                                      *
+ * The game is built without optimization, where even a one-line        *
+ * member function is a real call.  Row lookups are on every path the   *
+ * pathfinding takes, so they're forced inline, and the storage is a    *
+ * bare array rather than a vector so there's nothing further to call.  */
+template <class T>
+class grid {
+ private:
+  T *cells;
+  uint16_t w, h;
+ public:
+  grid() : cells(0), w(0), h(0) {}
+  grid(uint16_t width, uint16_t height, T value = T()) : cells(0), w(0), h(0)
+  {
+    resize(width, height, value);
+  }
+  grid(const grid &o) : cells(0), w(0), h(0)
+  {
+    *this = o;
+  }
+  ~grid()
+  {
+    delete [] cells;
+  }
+  grid &operator=(const grid &o)
+  {
+    if (this != &o) {
+      if (size() != o.size()) {
+        delete [] cells;
+        cells = new T[o.size()];
+      }
+      w = o.w;
+      h = o.h;
+      std::copy(o.cells, o.cells + o.size(), cells);
+    }
+    return *this;
+  }
+  /* Discards the contents; every cell becomes value. */
+  void resize(uint16_t width, uint16_t height, T value = T())
+  {
+    if ((uint32_t) width * height != size()) {
+      delete [] cells;
+      cells = new T[(uint32_t) width * height];
+    }
+    w = width;
+    h = height;
+    fill(value);
+  }
+  /* Exchanges contents with o, whatever the two sizes, in O(1). */
+  void swap(grid &o)
+  {
+    std::swap(cells, o.cells);
+    std::swap(w, o.w);
+    std::swap(h, o.h);
+  }
+  void fill(T value)
+  {
+    std::fill(cells, cells + size(), value);
+  }
+  inline uint16_t width() const
+  {
+    return w;
+  }
+  inline uint16_t height() const
+  {
+    return h;
+  }
+  inline uint32_t size() const
+  {
+    return (uint32_t) w * h;
+  }
+  inline T *data() __attribute__ ((always_inline))
+  {
+    return cells;
+  }
+  inline const T *data() const __attribute__ ((always_inline))
+  {
+    return cells;
+  }
+  inline T *operator[](int32_t row) __attribute__ ((always_inline))
+  {
+    return cells + row * w;
+  }
+  inline const T *operator[](int32_t row) const __attribute__ ((always_inline))
+  {
+    return cells + row * w;
+  }
+  bool operator==(const grid &o) const
+  {
+    return w == o.w && h == o.h && std::equal(cells, cells + size(), o.cells);
+  }
+  bool operator!=(const grid &o) const
+  {
+    return !(*this == o);
+  }
+};
+
+#endif
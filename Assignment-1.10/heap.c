@@ -15,6 +15,19 @@ struct heap_node {
   uint32_t mark;
 };
 
+typedef struct heap_pool_slab {
+  struct heap_pool_slab *next;
+  uint32_t size;
+  heap_node_t node[];
+} heap_pool_slab_t;
+
+struct heap_pool {
+  heap_pool_slab_t *slabs;
+  heap_pool_slab_t *current;
+  uint32_t used;
+  heap_node_t *free;
+};
+
 #define swap(a, b) ({    \
   typeof (a) _tmp = (a); \
   (a) = (b);             \
@@ -91,14 +104,112 @@ void print_heap_node_list(heap_node_t *n)
   printf("\n");
 }
 
+static heap_pool_slab_t *heap_pool_slab_new(uint32_t size)
+{
+  heap_pool_slab_t *s;
+
+  assert((s = malloc(sizeof (*s) + size * sizeof (s->node[0]))));
+  s->next = NULL;
+  s->size = size;
+
+  return s;
+}
+
+heap_pool_t *heap_pool_new(uint32_t reserve)
+{
+  heap_pool_t *p;
+
+  assert((p = malloc(sizeof (*p))));
+  p->slabs = p->current = heap_pool_slab_new(reserve ? reserve : 1);
+  p->used = 0;
+  p->free = NULL;
+
+  return p;
+}
+
+void heap_pool_reset(heap_pool_t *p)
+{
+  /* Slabs are kept, so a pool that has grown stays grown. */
+  p->current = p->slabs;
+  p->used = 0;
+  p->free = NULL;
+}
+
+void heap_pool_delete(heap_pool_t *p)
+{
+  heap_pool_slab_t *s;
+
+  while ((s = p->slabs)) {
+    p->slabs = s->next;
+    free(s);
+  }
+  free(p);
+}
+
+static heap_node_t *heap_pool_alloc(heap_pool_t *p)
+{
+  heap_node_t *n;
+
+  if ((n = p->free)) {
+    p->free = n->next;
+  } else {
+    if (p->used == p->current->size) {
+      if (!p->current->next) {
+        p->current->next = heap_pool_slab_new(p->current->size);
+      }
+      p->current = p->current->next;
+      p->used = 0;
+    }
+    n = p->current->node + p->used++;
+  }
+  memset(n, 0, sizeof (*n));
+
+  return n;
+}
+
+static heap_node_t *heap_node_alloc(heap_t *h)
+{
+  heap_node_t *n;
+
+  if (h->pool) {
+    return heap_pool_alloc(h->pool);
+  }
+
+  assert((n = calloc(1, sizeof (*n))));
+
+  return n;
+}
+
+static void heap_node_free(heap_t *h, heap_node_t *n)
+{
+  if (h->pool) {
+    n->next = h->pool->free;
+    h->pool->free = n;
+  } else {
+    free(n);
+  }
+}
+
 void heap_init(heap_t *h,
                int32_t (*compare)(const void *key, const void *with),
                void (*datum_delete)(void *))
+{
+  heap_init_pooled(h, compare, datum_delete, NULL);
+}
+
+void heap_init_pooled(heap_t *h,
+                      int32_t (*compare)(const void *key, const void *with),
+                      void (*datum_delete)(void *),
+                      heap_pool_t *pool)
 {
   h->min = NULL;
   h->size = 0;
   h->compare = compare;
   h->datum_delete = datum_delete;
+  h->pool = pool;
+  if (pool) {
+    heap_pool_reset(pool);
+  }
 }
 
 void heap_node_delete(heap_t *h, heap_node_t *hn)
@@ -114,27 +225,35 @@ void heap_node_delete(heap_t *h, heap_node_t *hn)
     if (h->datum_delete) {
       h->datum_delete(hn->datum);
     }
-    free(hn);
+    if (!h->pool) {
+      free(hn);
+    }
     hn = next;
   }
 }
 
 void heap_delete(heap_t *h)
 {
-  if (h->min) {
+  /* Pooled nodes are released all at once by the reset, so unless *
+   * there are data to delete, we don't need to walk the heap.      */
+  if (h->min && (!h->pool || h->datum_delete)) {
     heap_node_delete(h, h->min);
   }
+  if (h->pool) {
+    heap_pool_reset(h->pool);
+  }
   h->min = NULL;
   h->size = 0;
   h->compare = NULL;
   h->datum_delete = NULL;
+  h->pool = NULL;
 }
 
 heap_node_t *heap_insert(heap_t *h, void *v)
 {
   heap_node_t *n;
 
-  assert((n = calloc(1, sizeof (*n))));
+  n = heap_node_alloc(h);
   n->datum = v;
 
   if (h->min) {
@@ -220,7 +339,7 @@ void *heap_remove_min(heap_t *h)
   if (h->min) {
     v = h->min->datum;
     if (h->size == 1) {
-      free(h->min);
+      heap_node_free(h, h->min);
       h->min = NULL;
     } else {
       if ((n = h->min->child)) {
@@ -234,7 +353,7 @@ void *heap_remove_min(heap_t *h)
       n = h->min;
       remove_heap_node_from_list(n);
       h->min = n->next;
-      free(n);
+      heap_node_free(h, n);
 
       heap_consolidate(h);
     }
@@ -248,12 +367,14 @@ void *heap_remove_min(heap_t *h)
 int heap_combine(heap_t *h, heap_t *h1, heap_t *h2)
 {
   if (h1->compare != h2->compare ||
-      h1->datum_delete != h2->datum_delete) {
+      h1->datum_delete != h2->datum_delete ||
+      h1->pool != h2->pool) {
     return 1;
   }
 
   h->compare = h1->compare;
   h->datum_delete = h1->datum_delete;
+  h->pool = h1->pool;
 
   if (!h1->min) {
     h->min = h2->min;
@@ -403,3 +524,106 @@ int main(int argc, char *argv[])
 }
 
 #endif
+
+#ifdef BENCHMARK
+
+/* Compares pooled and unpooled heaps on a dijkstra-like workload:     *
+ * insert every key, then repeatedly remove the minimum and decrease a *
+ * few random keys.  Build with:  gcc -O2 -DBENCHMARK heap.c           */
+
+#include <time.h>
+
+typedef struct bench_key {
+  heap_node_t *hn;
+  int32_t key;
+} bench_key_t;
+
+typedef struct bench_result {
+  double seconds;
+  uint64_t ops;
+  uint64_t checksum;
+} bench_result_t;
+
+static int32_t bench_cmp(const void *key, const void *with)
+{
+  return ((bench_key_t *) key)->key - ((bench_key_t *) with)->key;
+}
+
+static bench_result_t bench_run(heap_pool_t *pool, bench_key_t *k,
+                                uint32_t n, uint32_t rounds)
+{
+  heap_t h;
+  bench_key_t *c;
+  struct timespec start, end;
+  bench_result_t r;
+  uint32_t i, j, round;
+
+  r.ops = r.checksum = 0;
+  srand(n);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (round = 0; round < rounds; round++) {
+    heap_init_pooled(&h, bench_cmp, NULL, pool);
+    for (i = 0; i < n; i++) {
+      k[i].key = 255 + rand() % 255;
+      k[i].hn = heap_insert(&h, k + i);
+    }
+    r.ops += n;
+    while ((c = heap_remove_min(&h))) {
+      c->hn = NULL;
+      r.ops++;
+      r.checksum = r.checksum * 31 + (c - k);
+      for (i = 0; i < 4; i++) {
+        j = rand() % n;
+        if (k[j].hn && k[j].key > c->key + 1) {
+          k[j].key = c->key + 1;
+          heap_decrease_key_no_replace(&h, k[j].hn);
+          r.ops++;
+        }
+      }
+    }
+    heap_delete(&h);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  r.seconds = ((end.tv_sec - start.tv_sec) +
+               (end.tv_nsec - start.tv_nsec) / 1000000000.0);
+
+  return r;
+}
+
+int main(int argc, char *argv[])
+{
+  bench_key_t *k;
+  heap_pool_t *pool;
+  bench_result_t plain, pooled;
+  uint32_t n, rounds;
+
+  n = argc > 1 ? atoi(argv[1]) : 1680;
+  rounds = argc > 2 ? atoi(argv[2]) : 2000;
+
+  assert((k = calloc(n, sizeof (*k))));
+  pool = heap_pool_new(n);
+
+  plain = bench_run(NULL, k, n, rounds);
+  pooled = bench_run(pool, k, n, rounds);
+
+  printf("%u keys, %u rounds\n", n, rounds);
+  printf("unpooled: %8.3f s  %6.2f Mops/s\n",
+         plain.seconds, plain.ops / plain.seconds / 1000000.0);
+  printf("pooled:   %8.3f s  %6.2f Mops/s\n",
+         pooled.seconds, pooled.ops / pooled.seconds / 1000000.0);
+  printf("speedup:  %8.2fx\n", plain.seconds / pooled.seconds);
+
+  if (plain.checksum != pooled.checksum) {
+    fprintf(stderr, "Removal order differs between pooled and unpooled!\n");
+    return 1;
+  }
+
+  heap_pool_delete(pool);
+  free(k);
+
+  return 0;
+}
+
+#endif
@@ -9,17 +9,34 @@ extern "C" {
 
 struct heap_node;
 typedef struct heap_node heap_node_t;
+struct heap_pool;
+typedef struct heap_pool heap_pool_t;
 
 typedef struct heap {
   heap_node_t *min;
   uint32_t size;
   int32_t (*compare)(const void *key, const void *with);
   void (*datum_delete)(void *);
+  heap_pool_t *pool;
 } heap_t;
 
+/* A node pool is a slab of heap nodes reserved up front.  A heap that *
+ * draws its nodes from a pool never calls malloc() or free() in the   *
+ * steady state, and heap_delete() releases all of its nodes in O(1)   *
+ * by resetting the pool.  Because of that reset, a pool may only back *
+ * one live heap at a time; it may be reused by any number of heaps in *
+ * sequence.                                                           */
+heap_pool_t *heap_pool_new(uint32_t reserve);
+void heap_pool_reset(heap_pool_t *p);
+void heap_pool_delete(heap_pool_t *p);
+
 void heap_init(heap_t *h,
                int32_t (*compare)(const void *key, const void *with),
                void (*datum_delete)(void *));
+void heap_init_pooled(heap_t *h,
+                      int32_t (*compare)(const void *key, const void *with),
+                      void (*datum_delete)(void *),
+                      heap_pool_t *pool);
 void heap_delete(heap_t *h);
 heap_node_t *heap_insert(heap_t *h, void *v);
 void *heap_peek_min(heap_t *h);
@@ -13,6 +13,7 @@
 #include "object.h"
 #include "npc.h"
 #include "character.h"
+#include "replay.h"
 
 /* Same ugly hack we did in path.c */
 static dungeon *thedungeon;
@@ -26,6 +27,97 @@ typedef struct io_message {
 
 static io_message_t *io_head, *io_tail;
 
+/* Set by io_init_headless().  Nothing is drawn, messages are       *
+ * dropped, and the PC is driven by pc_next_pos()--or by the replay *
+ * log, when there is one--instead of the keyboard.  Menus reached  *
+ * from a replay still call ncurses directly, so they get a screen  *
+ * that writes to /dev/null.                                        */
+static uint32_t io_headless;
+static FILE *io_null;
+
+/* Number of PC turns so far; the timestamp on replay records. */
+static uint32_t io_turn;
+
+/* The map occupies rows 1 through VIEW_Y of the screen, under the  *
+ * message line.  A dungeon bigger than that scrolls: io_origin is  *
+ * the dungeon cell drawn in the top-left corner of the map area,   *
+ * and io_map_addch() translates dungeon coordinates to the screen, *
+ * dropping anything outside the view.  The view follows the PC, or *
+ * the targeting cursor while one is up.                            */
+#define VIEW_X DUNGEON_X
+#define VIEW_Y DUNGEON_Y
+static pair_t io_origin;
+static int16_t *io_focus;
+
+/* Recenters the view when the focus gets within a quarter screen of *
+ * an edge.  Returns non-zero if the view moved.                     */
+static uint32_t io_scroll(dungeon *d)
+{
+  int16_t *focus;
+  int32_t view[num_dims] = { VIEW_X, VIEW_Y };
+  int32_t map[num_dims] = { d->width, d->height };
+  int32_t origin;
+  uint32_t dim, moved;
+
+  focus = io_focus ? io_focus : d->PC->position;
+  for (moved = 0, dim = 0; dim < num_dims; dim++) {
+    origin = io_origin[dim];
+    if (focus[dim] < origin + view[dim] / 4 ||
+        focus[dim] >= origin + view[dim] - view[dim] / 4) {
+      origin = focus[dim] - view[dim] / 2;
+    }
+    if (origin > map[dim] - view[dim]) {
+      origin = map[dim] - view[dim];
+    }
+    if (origin < 0) {
+      origin = 0;
+    }
+    if (origin != io_origin[dim]) {
+      io_origin[dim] = origin;
+      moved = 1;
+    }
+  }
+
+  return moved;
+}
+
+static void io_map_addch(int16_t y, int16_t x, chtype ch)
+{
+  if (y >= io_origin[dim_y] && y < io_origin[dim_y] + VIEW_Y &&
+      x >= io_origin[dim_x] && x < io_origin[dim_x] + VIEW_X) {
+    mvaddch(y - io_origin[dim_y] + 1, x - io_origin[dim_x], ch);
+  }
+}
+
+void io_init_headless(void)
+{
+  io_headless = 1;
+  if (!(io_null = fopen("/dev/null", "r+")) ||
+      !newterm("vt100", io_null, io_null)) {
+    fprintf(stderr, "Unable to initialize a headless terminal.\n");
+    exit(-1);
+  }
+}
+
+/* All input that can change the game goes through here, so that it *
+ * can be recorded and replayed.  The --more-- prompt doesn't; it   *
+ * never happens headless and its key doesn't matter.               */
+static int io_getch(void)
+{
+  int key;
+
+  if (replay_is_replaying()) {
+    return replay_read_key(io_turn);
+  }
+
+  key = getch();
+  if (replay_is_recording()) {
+    replay_write_key(io_turn, key);
+  }
+
+  return key;
+}
+
 void io_init_terminal(void)
 {
   initscr();
@@ -46,6 +138,10 @@ void io_init_terminal(void)
 void io_reset_terminal(void)
 {
   endwin();
+  if (io_null) {
+    fclose(io_null);
+    io_null = NULL;
+  }
 
   while (io_head) {
     io_tail = io_head;
@@ -60,6 +156,10 @@ void io_queue_message(const char *format, ...)
   io_message_t *tmp;
   va_list ap;
 
+  if (io_headless) {
+    return;
+  }
+
   if (!(tmp = (io_message_t *) malloc(sizeof (*tmp)))) {
     perror("malloc");
     exit(1);
@@ -103,16 +203,18 @@ static void io_print_message_queue(uint32_t y, uint32_t x)
 
 void io_display_tunnel(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
+  path_update(d);
+  io_scroll(d);
   clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = io_origin[dim_y]; y < io_origin[dim_y] + VIEW_Y; y++) {
+    for (x = io_origin[dim_x]; x < io_origin[dim_x] + VIEW_X; x++) {
       if (charxy(x, y) == d->PC) {
-        mvaddch(y + 1, x, charxy(x, y)->symbol);
+        io_map_addch(y, x, charxy(x, y)->symbol);
       } else if (hardnessxy(x, y) == 255) {
-        mvaddch(y + 1, x, '*');
+        io_map_addch(y, x, '*');
       } else {
-        mvaddch(y + 1, x, '0' + (d->pc_tunnel[y][x] % 10));
+        io_map_addch(y, x, '0' + (d->pc_tunnel.get(y, x) % 10));
       }
     }
   }
@@ -121,16 +223,18 @@ void io_display_tunnel(dungeon *d)
 
 void io_display_distance(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
+  path_update(d);
+  io_scroll(d);
   clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = io_origin[dim_y]; y < io_origin[dim_y] + VIEW_Y; y++) {
+    for (x = io_origin[dim_x]; x < io_origin[dim_x] + VIEW_X; x++) {
       if (charxy(x, y)) {
-        mvaddch(y + 1, x, charxy(x, y)->symbol);
+        io_map_addch(y, x, charxy(x, y)->symbol);
       } else if (hardnessxy(x, y) != 0) {
-        mvaddch(y + 1, x, ' ');
+        io_map_addch(y, x, ' ');
       } else {
-        mvaddch(y + 1, x, '0' + (d->pc_distance[y][x] % 10));
+        io_map_addch(y, x, '0' + (d->pc_distance.get(y, x) % 10));
       }
     }
   }
@@ -142,19 +246,20 @@ static char hardness_to_char[] =
 
 void io_display_hardness(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
+  io_scroll(d);
   clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = io_origin[dim_y]; y < io_origin[dim_y] + VIEW_Y; y++) {
+    for (x = io_origin[dim_x]; x < io_origin[dim_x] + VIEW_X; x++) {
       /* Maximum hardness is 255.  We have 62 values to display it, but *
        * we only want one zero value, so we need to cover [1,255] with  *
        * 61 values, which gives us a divisor of 254 / 61 = 4.164.       *
        * Generally, we want to avoid floating point math, but this is   *
        * not gameplay, so we'll make an exception here to get maximal   *
        * hardness display resolution.                                   */
-      mvaddch(y + 1, x, (d->hardness[y][x]                             ?
-                         hardness_to_char[1 + (int) ((d->hardness[y][x] /
-                                                      4.2))] : ' '));
+      io_map_addch(y, x, (d->hardness[y][x]                             ?
+                              hardness_to_char[1 + (int) ((d->hardness[y][x] /
+                                                           4.2))] : ' '));
     }
   }
   refresh();
@@ -184,9 +289,9 @@ static void io_redisplay_visible_monsters(dungeon *d, pair_t cursor)
          pos[dim_x] <= PC_VISUAL_RANGE;
          pos[dim_x]++) {
       if ((d->PC->position[dim_y] + pos[dim_y] < 0) ||
-          (d->PC->position[dim_y] + pos[dim_y] >= DUNGEON_Y) ||
+          (d->PC->position[dim_y] + pos[dim_y] >= d->height) ||
           (d->PC->position[dim_x] + pos[dim_x] < 0) ||
-          (d->PC->position[dim_x] + pos[dim_x] >= DUNGEON_X)) {
+          (d->PC->position[dim_x] + pos[dim_x] >= d->width)) {
         continue;
       }
       if ((illuminated = is_illuminated(d->PC,
@@ -196,8 +301,8 @@ static void io_redisplay_visible_monsters(dungeon *d, pair_t cursor)
       }
       if (cursor[dim_y] == d->PC->position[dim_y] + pos[dim_y] &&
           cursor[dim_x] == d->PC->position[dim_x] + pos[dim_x]) {
-        mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                d->PC->position[dim_x] + pos[dim_x], '*');
+        io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                     d->PC->position[dim_x] + pos[dim_x], '*');
       } else if (d->character_map[d->PC->position[dim_y] + pos[dim_y]]
                                  [d->PC->position[dim_x] + pos[dim_x]] &&
                  can_see(d, d->PC->position,
@@ -208,12 +313,12 @@ static void io_redisplay_visible_monsters(dungeon *d, pair_t cursor)
                                                     pos[dim_y]]
                                                    [d->PC->position[dim_x] +
                                                     pos[dim_x]]->get_color())));
-        mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                d->PC->position[dim_x] + pos[dim_x],
-                character_get_symbol(d->character_map[d->PC->position[dim_y] +
-                                                      pos[dim_y]]
-                                                     [d->PC->position[dim_x] +
-                                                      pos[dim_x]]));
+        io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                     d->PC->position[dim_x] + pos[dim_x],
+                     character_get_symbol(d->character_map
+                                          [d->PC->position[dim_y] + pos[dim_y]]
+                                          [d->PC->position[dim_x] +
+                                           pos[dim_x]]));
         attroff(COLOR_PAIR(color));
       } else if (d->objmap[d->PC->position[dim_y] + pos[dim_y]]
                           [d->PC->position[dim_x] + pos[dim_x]] &&
@@ -226,10 +331,11 @@ static void io_redisplay_visible_monsters(dungeon *d, pair_t cursor)
         attron(COLOR_PAIR(d->objmap[d->PC->position[dim_y] + pos[dim_y]]
                                    [d->PC->position[dim_x] +
                                     pos[dim_x]]->get_color()));
-        mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                d->PC->position[dim_x] + pos[dim_x],
-                d->objmap[d->PC->position[dim_y] + pos[dim_y]]
-                         [d->PC->position[dim_x] + pos[dim_x]]->get_symbol());
+        io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                     d->PC->position[dim_x] + pos[dim_x],
+                     d->objmap[d->PC->position[dim_y] + pos[dim_y]]
+                              [d->PC->position[dim_x] +
+                               pos[dim_x]]->get_symbol());
         attroff(COLOR_PAIR(d->objmap[d->PC->position[dim_y] + pos[dim_y]]
                                     [d->PC->position[dim_x] +
                                      pos[dim_x]]->get_color()));
@@ -241,39 +347,39 @@ static void io_redisplay_visible_monsters(dungeon *d, pair_t cursor)
         case ter_wall:
         case ter_wall_immutable:
         case ter_unknown:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], ' ');
+          io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                       d->PC->position[dim_x] + pos[dim_x], ' ');
           break;
         case ter_floor:
         case ter_floor_room:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '.');
+          io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                       d->PC->position[dim_x] + pos[dim_x], '.');
           break;
         case ter_floor_hall:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '#');
+          io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                       d->PC->position[dim_x] + pos[dim_x], '#');
           break;
         case ter_debug:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '*');
+          io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                       d->PC->position[dim_x] + pos[dim_x], '*');
           break;
         case ter_stairs_up:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '<');
+          io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                       d->PC->position[dim_x] + pos[dim_x], '<');
           break;
         case ter_stairs_down:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '>');
+          io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                       d->PC->position[dim_x] + pos[dim_x], '>');
           break;
         case ter_store:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '^');
+          io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                       d->PC->position[dim_x] + pos[dim_x], '^');
           break;
         default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '0');
+          io_map_addch(d->PC->position[dim_y] + pos[dim_y],
+                       d->PC->position[dim_x] + pos[dim_x], '0');
         }
       }
       attroff(A_BOLD);
@@ -288,41 +394,48 @@ static int compare_monster_distance(const void *v1, const void *v2)
   const character *const *c1 = (const character *const *) v1;
   const character *const *c2 = (const character *const *) v2;
 
-  return (thedungeon->pc_distance[(*c1)->position[dim_y]]
-                                 [(*c1)->position[dim_x]] -
-          thedungeon->pc_distance[(*c2)->position[dim_y]]
-                                 [(*c2)->position[dim_x]]);
+  uint32_t d1, d2;
+
+  d1 = thedungeon->pc_distance.get((*c1)->position[dim_y],
+                                   (*c1)->position[dim_x]);
+  d2 = thedungeon->pc_distance.get((*c2)->position[dim_y],
+                                   (*c2)->position[dim_x]);
+
+  /* Not d1 - d2, which overflows with four-byte distances. */
+  return (d1 > d2) - (d1 < d2);
 }
 
+/* Only the monsters within the PC's sight can be visible, so there's *
+ * no need to sort all of them; just keep the closest one seen.  Ties *
+ * go to the first in reading order.                                  */
 static character *io_nearest_visible_monster(dungeon *d)
 {
-  character **c, *n;
-  uint32_t x, y, count, i;
+  static std::vector<character *> c;
+  character *n;
+  uint32_t i;
+  int32_t cmp;
 
-  c = (character **) malloc(d->num_monsters * sizeof (*c));
+  c.clear();
+  d->monsters.near(character_get_pos(d->PC), PC_VISUAL_RANGE, c);
 
-  /* Get a linear list of monsters */
-  for (count = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
-      if (d->character_map[y][x] && d->character_map[y][x] != d->PC) {
-        c[count++] = d->character_map[y][x];
-      }
-    }
-  }
-
-  /* Sort it by distance from PC */
+  path_update(d);
   thedungeon = d;
-  qsort(c, count, sizeof (*c), compare_monster_distance);
-
-  for (n = NULL, i = 0; i < count; i++) {
-    if (can_see(d, character_get_pos(d->PC), character_get_pos(c[i]), 1, 0)) {
-      n = c[i];
-      break;
+  for (n = NULL, i = 0; i < c.size(); i++) {
+    if (!can_see(d, character_get_pos(d->PC), character_get_pos(c[i]), 1, 0)) {
+      continue;
+    }
+    if (n) {
+      cmp = compare_monster_distance(&c[i], &n);
+      if (cmp > 0 ||
+          (!cmp && (c[i]->position[dim_y] > n->position[dim_y] ||
+                    (c[i]->position[dim_y] == n->position[dim_y] &&
+                     c[i]->position[dim_x] > n->position[dim_x])))) {
+        continue;
+      }
     }
+    n = c[i];
   }
 
-  free(c);
-
   return n;
 }
 
@@ -334,11 +447,18 @@ void io_display(dungeon *d)
   character *c;
   int32_t visible_monsters;
 
+  if (io_headless) {
+    return;
+  }
+
+  io_scroll(d);
   clear();
-  for (visible_monsters = -1, pos[dim_y] = 0;
-       pos[dim_y] < DUNGEON_Y;
+  for (visible_monsters = -1, pos[dim_y] = io_origin[dim_y];
+       pos[dim_y] < io_origin[dim_y] + VIEW_Y;
        pos[dim_y]++) {
-    for (pos[dim_x] = 0; pos[dim_x] < DUNGEON_X; pos[dim_x]++) {
+    for (pos[dim_x] = io_origin[dim_x];
+         pos[dim_x] < io_origin[dim_x] + VIEW_X;
+         pos[dim_x]++) {
       if ((illuminated = is_illuminated(d->PC,
                                         pos[dim_y],
                                         pos[dim_x]))) {
@@ -353,9 +473,9 @@ void io_display(dungeon *d)
         visible_monsters++;
         attron(COLOR_PAIR((color = d->character_map[pos[dim_y]]
                                                    [pos[dim_x]]->get_color())));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
-                character_get_symbol(d->character_map[pos[dim_y]]
-                                                     [pos[dim_x]]));
+        io_map_addch(pos[dim_y], pos[dim_x],
+                     character_get_symbol(d->character_map[pos[dim_y]]
+                                                          [pos[dim_x]]));
         attroff(COLOR_PAIR(color));
       } else if (d->objmap[pos[dim_y]]
                           [pos[dim_x]] &&
@@ -364,9 +484,9 @@ void io_display(dungeon *d)
                   can_see(d, character_get_pos(d->PC), pos, 1, 0))) {
         attron(COLOR_PAIR(d->objmap[pos[dim_y]]
                                    [pos[dim_x]]->get_color()));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
-                d->objmap[pos[dim_y]]
-                         [pos[dim_x]]->get_symbol());
+        io_map_addch(pos[dim_y], pos[dim_x],
+                     d->objmap[pos[dim_y]]
+                              [pos[dim_x]]->get_symbol());
         attroff(COLOR_PAIR(d->objmap[pos[dim_y]]
                                     [pos[dim_x]]->get_color()));
       } else {
@@ -376,32 +496,32 @@ void io_display(dungeon *d)
         case ter_wall:
         case ter_wall_immutable:
         case ter_unknown:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], ' ');
+          io_map_addch(pos[dim_y], pos[dim_x], ' ');
           break;
         case ter_floor:
         case ter_floor_room:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '.');
+          io_map_addch(pos[dim_y], pos[dim_x], '.');
           break;
         case ter_floor_hall:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '#');
+          io_map_addch(pos[dim_y], pos[dim_x], '#');
           break;
         case ter_debug:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '*');
+          io_map_addch(pos[dim_y], pos[dim_x], '*');
           break;
         case ter_stairs_up:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '<');
+          io_map_addch(pos[dim_y], pos[dim_x], '<');
           break;
         case ter_stairs_down:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '>');
+          io_map_addch(pos[dim_y], pos[dim_x], '>');
           break;
         //Lee's
         case ter_store:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '^');
+          io_map_addch(pos[dim_y], pos[dim_x], '^');
           break;  
         default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '0');
+          io_map_addch(pos[dim_y], pos[dim_x], '0');
         }
       }
       if (illuminated) {
@@ -446,25 +566,30 @@ static void io_redisplay_non_terrain(dungeon *d, pair_t cursor)
   uint32_t color;
   uint32_t illuminated;
 
-  for (pos[dim_y] = 0; pos[dim_y] < DUNGEON_Y; pos[dim_y]++) {
-    for (pos[dim_x] = 0; pos[dim_x] < DUNGEON_X; pos[dim_x]++) {
+  for (pos[dim_y] = io_origin[dim_y];
+       pos[dim_y] < io_origin[dim_y] + VIEW_Y;
+       pos[dim_y]++) {
+    for (pos[dim_x] = io_origin[dim_x];
+         pos[dim_x] < io_origin[dim_x] + VIEW_X;
+         pos[dim_x]++) {
       if ((illuminated = is_illuminated(d->PC,
                                         pos[dim_y],
                                         pos[dim_x]))) {
         attron(A_BOLD);
       }
       if (cursor[dim_y] == pos[dim_y] && cursor[dim_x] == pos[dim_x]) {
-        mvaddch(pos[dim_y] + 1, pos[dim_x], '*');
+        io_map_addch(pos[dim_y], pos[dim_x], '*');
       } else if (d->character_map[pos[dim_y]][pos[dim_x]]) {
         attron(COLOR_PAIR((color = d->character_map[pos[dim_y]]
                                                    [pos[dim_x]]->get_color())));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
-                character_get_symbol(d->character_map[pos[dim_y]][pos[dim_x]]));
+        io_map_addch(pos[dim_y], pos[dim_x],
+                     character_get_symbol(d->character_map[pos[dim_y]]
+                                                          [pos[dim_x]]));
         attroff(COLOR_PAIR(color));
       } else if (d->objmap[pos[dim_y]][pos[dim_x]]) {
         attron(COLOR_PAIR(d->objmap[pos[dim_y]][pos[dim_x]]->get_color()));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
-                d->objmap[pos[dim_y]][pos[dim_x]]->get_symbol());
+        io_map_addch(pos[dim_y], pos[dim_x],
+                     d->objmap[pos[dim_y]][pos[dim_x]]->get_symbol());
         attroff(COLOR_PAIR(d->objmap[pos[dim_y]][pos[dim_x]]->get_color()));
       }
       attroff(A_BOLD);
@@ -476,50 +601,51 @@ static void io_redisplay_non_terrain(dungeon *d, pair_t cursor)
 
 void io_display_no_fog(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
   uint32_t color;
   character *c;
 
+  io_scroll(d);
   clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = io_origin[dim_y]; y < io_origin[dim_y] + VIEW_Y; y++) {
+    for (x = io_origin[dim_x]; x < io_origin[dim_x] + VIEW_X; x++) {
       if (d->character_map[y][x]) {
         attron(COLOR_PAIR((color = d->character_map[y][x]->get_color())));
-        mvaddch(y + 1, x, character_get_symbol(d->character_map[y][x]));
+        io_map_addch(y, x, character_get_symbol(d->character_map[y][x]));
         attroff(COLOR_PAIR(color));
       } else if (d->objmap[y][x]) {
         attron(COLOR_PAIR(d->objmap[y][x]->get_color()));
-        mvaddch(y + 1, x, d->objmap[y][x]->get_symbol());
+        io_map_addch(y, x, d->objmap[y][x]->get_symbol());
         attroff(COLOR_PAIR(d->objmap[y][x]->get_color()));
       } else {
         switch (mapxy(x, y)) {
         case ter_wall:
         case ter_wall_immutable:
-          mvaddch(y + 1, x, ' ');
+          io_map_addch(y, x, ' ');
           break;
         case ter_floor:
         case ter_floor_room:
-          mvaddch(y + 1, x, '.');
+          io_map_addch(y, x, '.');
           break;
         case ter_floor_hall:
-          mvaddch(y + 1, x, '#');
+          io_map_addch(y, x, '#');
           break;
         case ter_debug:
-          mvaddch(y + 1, x, '*');
+          io_map_addch(y, x, '*');
           break;
         case ter_stairs_up:
-          mvaddch(y + 1, x, '<');
+          io_map_addch(y, x, '<');
           break;
         case ter_stairs_down:
-          mvaddch(y + 1, x, '>');
+          io_map_addch(y, x, '>');
           break;
         case ter_store:
-          mvaddch(y + 1, x, '^');
+          io_map_addch(y, x, '^');
           break;
         default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-          mvaddch(y + 1, x, '0');
+          io_map_addch(y, x, '0');
         }
       }
     }
@@ -560,7 +686,7 @@ void io_display_monster_list(dungeon *d)
   mvprintw(12, 33, " Speed: XXXXX ");
   mvprintw(14, 27, " Hit any key to continue. ");
   refresh();
-  getch();
+  io_getch();
 }
 
 uint32_t io_teleport_pc(dungeon *d)
@@ -578,8 +704,9 @@ uint32_t io_teleport_pc(dungeon *d)
 
   dest[dim_y] = d->PC->position[dim_y];
   dest[dim_x] = d->PC->position[dim_x];
+  io_focus = dest;
 
-  mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
+  io_map_addch(dest[dim_y], dest[dim_x], '*');
   refresh();
 
   do {
@@ -599,33 +726,33 @@ uint32_t io_teleport_pc(dungeon *d)
     case ter_wall:
     case ter_wall_immutable:
     case ter_unknown:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], ' ');
+      io_map_addch(dest[dim_y], dest[dim_x], ' ');
       break;
     case ter_floor:
     case ter_floor_room:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '.');
+      io_map_addch(dest[dim_y], dest[dim_x], '.');
       break;
     case ter_floor_hall:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '#');
+      io_map_addch(dest[dim_y], dest[dim_x], '#');
       break;
     case ter_debug:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
+      io_map_addch(dest[dim_y], dest[dim_x], '*');
       break;
     case ter_stairs_up:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '<');
+      io_map_addch(dest[dim_y], dest[dim_x], '<');
       break;
     case ter_stairs_down:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '>');
+      io_map_addch(dest[dim_y], dest[dim_x], '>');
       break;
     case ter_store:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '^');;
+      io_map_addch(dest[dim_y], dest[dim_x], '^');;
       break;
     default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '0');
+      io_map_addch(dest[dim_y], dest[dim_x], '0');
     }
-    switch ((c = getch())) {
+    switch ((c = io_getch())) {
     case '7':
     case 'y':
     case KEY_HOME:
@@ -649,38 +776,38 @@ uint32_t io_teleport_pc(dungeon *d)
       if (dest[dim_y] != 1) {
         dest[dim_y]--;
       }
-      if (dest[dim_x] != DUNGEON_X - 2) {
+      if (dest[dim_x] != d->width - 2) {
         dest[dim_x]++;
       }
       break;
     case '6':
     case 'l':
     case KEY_RIGHT:
-      if (dest[dim_x] != DUNGEON_X - 2) {
+      if (dest[dim_x] != d->width - 2) {
         dest[dim_x]++;
       }
       break;
     case '3':
     case 'n':
     case KEY_NPAGE:
-      if (dest[dim_y] != DUNGEON_Y - 2) {
+      if (dest[dim_y] != d->height - 2) {
         dest[dim_y]++;
       }
-      if (dest[dim_x] != DUNGEON_X - 2) {
+      if (dest[dim_x] != d->width - 2) {
         dest[dim_x]++;
       }
       break;
     case '2':
     case 'j':
     case KEY_DOWN:
-      if (dest[dim_y] != DUNGEON_Y - 2) {
+      if (dest[dim_y] != d->height - 2) {
         dest[dim_y]++;
       }
       break;
     case '1':
     case 'b':
     case KEY_END:
-      if (dest[dim_y] != DUNGEON_Y - 2) {
+      if (dest[dim_y] != d->height - 2) {
         dest[dim_y]++;
       }
       if (dest[dim_x] != 1) {
@@ -695,12 +822,18 @@ uint32_t io_teleport_pc(dungeon *d)
       }
       break;
     }
+    if (io_scroll(d)) {
+      io_display_no_fog(d);
+      mvprintw(0, 0, "Choose a location.  "
+               "'g' or '.' to teleport to; 'r' for random.");
+    }
   } while (c != 'g' && c != '.' && c != 'r');
+  io_focus = NULL;
 
   if (c == 'r') {
     do {
-      dest[dim_x] = rand_range(1, DUNGEON_X - 2);
-      dest[dim_y] = rand_range(1, DUNGEON_Y - 2);
+      dest[dim_x] = d->ai_rng.range(1, d->width - 2);
+      dest[dim_y] = d->ai_rng.range(1, d->height - 2);
     } while (charpair(dest) || mappair(dest) < ter_floor);
   }
 
@@ -715,8 +848,7 @@ uint32_t io_teleport_pc(dungeon *d)
   }
 
   pc_observe_terrain(d->PC, d);
-  dijkstra(d);
-  dijkstra_tunnel(d);
+  path_pc_moved(d);
 
   io_display(d);
 
@@ -768,7 +900,7 @@ static void io_scroll_monster_list(char (*s)[60], uint32_t count)
     for (i = 0; i < 13; i++) {
       mvprintw(i + 6, 9, " %-60s ", s[i + offset]);
     }
-    switch (getch()) {
+    switch (io_getch()) {
     case KEY_UP:
       if (offset) {
         offset--;
@@ -846,7 +978,7 @@ static void io_list_monsters_display(dungeon *d,
   if (count <= 13) {
     mvprintw(count + 6, 9, " %-60s ", "");
     mvprintw(count + 7, 9, " %-60s ", "Hit escape to continue.");
-    while (getch() != 27 /* escape */)
+    while (io_getch() != 27 /* escape */)
       ;
   } else {
     mvprintw(19, 9, " %-60s ", "");
@@ -860,23 +992,22 @@ static void io_list_monsters_display(dungeon *d,
 
 static void io_list_monsters(dungeon *d)
 {
+  std::vector<character *> near;
   character **c;
-  uint32_t x, y, count;
-
-  c = (character **) malloc(d->num_monsters * sizeof (*c));
-
-  /* Get a linear list of monsters */
-  for (count = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
-      if (d->character_map[y][x] && d->character_map[y][x] != d->PC &&
-          can_see(d, character_get_pos(d->PC),
-                  character_get_pos(d->character_map[y][x]), 1, 0)) {
-        c[count++] = d->character_map[y][x];
-      }
+  uint32_t i, count;
+
+  /* Get a linear list of the monsters the PC can see */
+  d->monsters.near(character_get_pos(d->PC), PC_VISUAL_RANGE, near);
+  c = (character **) malloc((near.size() + 1) * sizeof (*c));
+  for (count = i = 0; i < near.size(); i++) {
+    if (can_see(d, character_get_pos(d->PC),
+                character_get_pos(near[i]), 1, 0)) {
+      c[count++] = near[i];
     }
   }
 
   /* Sort it by distance from PC */
+  path_update(d);
   thedungeon = d;
   qsort(c, count, sizeof (*c), compare_monster_distance);
 
@@ -894,7 +1025,7 @@ void io_display_ch(dungeon *d)
   mvprintw(12, 33, " Speed: %5d ", d->PC->speed);
   mvprintw(14, 27, " Hit any key to continue. ");
   refresh();
-  getch();
+  io_getch();
   io_display(d);
 }
 
@@ -928,7 +1059,7 @@ uint32_t io_wear_eq(dungeon *d)
   refresh();
 
   while (1) {
-    if ((key = getch()) == 27 /* ESC */) {
+    if ((key = io_getch()) == 27 /* ESC */) {
       io_display(d);
       return 1;
     }
@@ -979,7 +1110,7 @@ void io_display_in(dungeon *d)
 
   refresh();
 
-  getch();
+  io_getch();
 
   io_display(d);
 }
@@ -999,7 +1130,7 @@ uint32_t io_remove_eq(dungeon *d)
   refresh();
 
   while (1) {
-    if ((key = getch()) == 27 /* ESC */) {
+    if ((key = io_getch()) == 27 /* ESC */) {
       io_display(d);
       return 1;
     }
@@ -1049,7 +1180,7 @@ void io_display_eq(dungeon *d)
 
   refresh();
 
-  getch();
+  io_getch();
 
   io_display(d);
 }
@@ -1068,7 +1199,7 @@ uint32_t io_drop_in(dungeon *d)
   refresh();
 
   while (1) {
-    if ((key = getch()) == 27 /* ESC */) {
+    if ((key = io_getch()) == 27 /* ESC */) {
       io_display(d);
       return 1;
     }
@@ -1133,7 +1264,7 @@ static uint32_t io_display_obj_info(object *o)
   mvprintw(n + 5, 0, "Hit any key to continue.");
 
   refresh();
-  getch();
+  io_getch();
 
   return 0;  
 }
@@ -1155,7 +1286,7 @@ static uint32_t io_inspect_in(dungeon *d)
   refresh();
 
   while (1) {
-    if ((key = getch()) == 27 /* ESC */) {
+    if ((key = io_getch()) == 27 /* ESC */) {
       io_display(d);
       return 1;
     }
@@ -1210,8 +1341,9 @@ static uint32_t io_inspect_monster(dungeon *d)
 
   dest[dim_y] = d->PC->position[dim_y];
   dest[dim_x] = d->PC->position[dim_x];
+  io_focus = dest;
 
-  mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
+  io_map_addch(dest[dim_y], dest[dim_x], '*');
   refresh();
 
   do {
@@ -1231,35 +1363,35 @@ static uint32_t io_inspect_monster(dungeon *d)
     case ter_wall:
     case ter_wall_immutable:
     case ter_unknown:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], ' ');
+      io_map_addch(dest[dim_y], dest[dim_x], ' ');
       break;
     case ter_floor:
     case ter_floor_room:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '.');
+      io_map_addch(dest[dim_y], dest[dim_x], '.');
       break;
     case ter_floor_hall:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '#');
+      io_map_addch(dest[dim_y], dest[dim_x], '#');
       break;
     case ter_debug:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
+      io_map_addch(dest[dim_y], dest[dim_x], '*');
       break;
     case ter_stairs_up:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '<');
+      io_map_addch(dest[dim_y], dest[dim_x], '<');
       break;
     case ter_stairs_down:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '>');
+      io_map_addch(dest[dim_y], dest[dim_x], '>');
       break;
     case ter_store:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '^');
+      io_map_addch(dest[dim_y], dest[dim_x], '^');
       break;
     default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '0');
+      io_map_addch(dest[dim_y], dest[dim_x], '0');
     }
     tmp[dim_y] = dest[dim_y];
     tmp[dim_x] = dest[dim_x];
-    switch ((c = getch())) {
+    switch ((c = io_getch())) {
     case '7':
     case 'y':
     case KEY_HOME:
@@ -1292,7 +1424,7 @@ static uint32_t io_inspect_monster(dungeon *d)
           can_see(d, d->PC->position, tmp, 1, 0)) {
         dest[dim_y]--;
       }
-      if (dest[dim_x] != DUNGEON_X - 2 &&
+      if (dest[dim_x] != d->width - 2 &&
           can_see(d, d->PC->position, tmp, 1, 0)) {
         dest[dim_x]++;
       }
@@ -1301,7 +1433,7 @@ static uint32_t io_inspect_monster(dungeon *d)
     case 'l':
     case KEY_RIGHT:
       tmp[dim_x]++;
-      if (dest[dim_x] != DUNGEON_X - 2 &&
+      if (dest[dim_x] != d->width - 2 &&
           can_see(d, d->PC->position, tmp, 1, 0)) {
         dest[dim_x]++;
       }
@@ -1311,11 +1443,11 @@ static uint32_t io_inspect_monster(dungeon *d)
     case KEY_NPAGE:
       tmp[dim_y]++;
       tmp[dim_x]++;
-      if (dest[dim_y] != DUNGEON_Y - 2 &&
+      if (dest[dim_y] != d->height - 2 &&
           can_see(d, d->PC->position, tmp, 1, 0)) {
         dest[dim_y]++;
       }
-      if (dest[dim_x] != DUNGEON_X - 2 &&
+      if (dest[dim_x] != d->width - 2 &&
           can_see(d, d->PC->position, tmp, 1, 0)) {
         dest[dim_x]++;
       }
@@ -1324,7 +1456,7 @@ static uint32_t io_inspect_monster(dungeon *d)
     case 'j':
     case KEY_DOWN:
       tmp[dim_y]++;
-      if (dest[dim_y] != DUNGEON_Y - 2 &&
+      if (dest[dim_y] != d->height - 2 &&
           can_see(d, d->PC->position, tmp, 1, 0)) {
         dest[dim_y]++;
       }
@@ -1334,7 +1466,7 @@ static uint32_t io_inspect_monster(dungeon *d)
     case KEY_END:
       tmp[dim_y]++;
       tmp[dim_x]--;
-      if (dest[dim_y] != DUNGEON_Y - 2 &&
+      if (dest[dim_y] != d->height - 2 &&
           can_see(d, d->PC->position, tmp, 1, 0)) {
         dest[dim_y]++;
       }
@@ -1353,9 +1485,15 @@ static uint32_t io_inspect_monster(dungeon *d)
       }
       break;
     }
+    if (io_scroll(d)) {
+      io_display(d);
+      mvprintw(0, 0,
+               "Choose a monster.  'g' or '.' to select; 'ESC' to cancel.");
+    }
   } while (((c == 'g' || c == '.') &&
             (!charpair(dest) || charpair(dest) == d->PC)) ||
            (c != 'g' && c != '.' && c != 27 /* ESC */));
+  io_focus = NULL;
 
   if (c == 27 /* ESC */) {
     io_display(d);
@@ -1382,7 +1520,7 @@ static uint32_t io_inspect_monster(dungeon *d)
 
   refresh();
   
-  getch();
+  io_getch();
 
   io_display(d);
 
@@ -1404,7 +1542,7 @@ static uint32_t io_inspect_eq(dungeon *d)
   refresh();
 
   while (1) {
-    if ((key = getch()) == 27 /* ESC */) {
+    if ((key = io_getch()) == 27 /* ESC */) {
       io_display(d);
       return 1;
     }
@@ -1460,7 +1598,7 @@ uint32_t io_expunge_in(dungeon *d)
   refresh();
 
   while (1) {
-    if ((key = getch()) == 27 /* ESC */) {
+    if ((key = io_getch()) == 27 /* ESC */) {
       io_display(d);
       return 1;
     }
@@ -1522,7 +1660,7 @@ void io_display_store_item(dungeon *d, object **store_item, uint32_t num)
   valid =0;
 
   do{
-    key = getch();
+    key = io_getch();
 
     if(key >= '1' && key <= num+'0' && store_item[key-'1']){
       if(d->PC->has_open_inventory_slot()){
@@ -1552,15 +1690,15 @@ void io_display_store_item(dungeon *d, object **store_item, uint32_t num)
 
 void io_generate_store_item(dungeon *d)
 {
-  uint32_t store_available_item = rand_range(3,6); //every store have different available item 
+  uint32_t store_available_item = d->loot_rng.range(3,6); //every store have different available item 
   object *store_item[store_available_item];
   object *o;
   uint32_t i;
 
   for(i =0; i<store_available_item;i++){
     do{
-      uint32_t random_item_from_description = rand_range(0,d->object_descriptions.size()-1);
-      o = new object(d->object_descriptions[random_item_from_description]);
+      uint32_t random_item_from_description = d->loot_rng.under(d->object_descriptions.size());
+      o = new object(d->object_descriptions[random_item_from_description], d->loot_rng);
     }while(o->get_type()<objtype_WEAPON || o->get_type()>objtype_RING);
     store_item[i]=o;
   }
@@ -1577,6 +1715,25 @@ void io_enter_store(dungeon *d)
   }
 }
 
+static void io_handle_ai(dungeon *d)
+{
+  pair_t dir;
+  int key;
+
+  /* pc_next_pos() gives a step, which maps onto the keypad digit  *
+   * move_pc() expects.  A zero step is a rest, and so is a bump   *
+   * into a wall, which at the keyboard costs a key but no turn.   *
+   * Record the rest too, so that a replay uses up the turn.       */
+  pc_next_pos(d, dir);
+  key = '5' + dir[dim_x] - 3 * dir[dim_y];
+  if (replay_is_recording()) {
+    replay_write_key(io_turn, key);
+  }
+  if (key != '5' && move_pc(d, key - '0') && replay_is_recording()) {
+    replay_write_key(io_turn, '5');
+  }
+}
+
 void io_handle_input(dungeon *d)
 {
   uint32_t fail_code;
@@ -1584,25 +1741,39 @@ void io_handle_input(dungeon *d)
   fd_set readfs;
   struct timeval tv;
   uint32_t fog_off = 0;
-  pair_t tmp = { DUNGEON_X, DUNGEON_Y };
+  pair_t tmp = { -1, -1 };
 
-  do {
-    do{
-      FD_ZERO(&readfs);
-      FD_SET(STDIN_FILENO, &readfs);
+  io_turn++;
 
-      tv.tv_sec = 0;
-      tv.tv_usec = 125000; /* An eigth of a second */
+  if (io_headless && !replay_is_replaying()) {
+    io_handle_ai(d);
+    return;
+  }
 
-      if (fog_off) {
-        /* Out-of-bounds cursor will not be rendered. */
-        io_redisplay_non_terrain(d, tmp);
-      } else {
-        io_redisplay_visible_monsters(d, tmp);
+  do {
+    if (replay_is_replaying()) {
+      if (replay_at_end()) {
+        d->quit = 1;
+        return;
       }
-    } while (!select(STDIN_FILENO + 1, &readfs, NULL, NULL, &tv));
+    } else {
+      do {
+        FD_ZERO(&readfs);
+        FD_SET(STDIN_FILENO, &readfs);
+
+        tv.tv_sec = 0;
+        tv.tv_usec = 125000; /* An eigth of a second */
+
+        if (fog_off) {
+          /* Out-of-bounds cursor will not be rendered. */
+          io_redisplay_non_terrain(d, tmp);
+        } else {
+          io_redisplay_visible_monsters(d, tmp);
+        }
+      } while (!select(STDIN_FILENO + 1, &readfs, NULL, NULL, &tv));
+    }
     fog_off = 0;
-    switch (key = getch()) {
+    switch (key = io_getch()) {
     case '7':
     case 'y':
     case KEY_HOME:
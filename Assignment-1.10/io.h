@@ -4,6 +4,7 @@
 class dungeon;
 
 void io_init_terminal(void);
+void io_init_headless(void);
 void io_reset_terminal(void);
 void io_display(dungeon *d);
 void io_handle_input(dungeon *d);
@@ -89,18 +89,19 @@ void do_combat(dungeon *d, character *atk, character *def)
   };
   if (character_is_alive(def)) {
     if (atk != d->PC) {
-      damage = atk->damage->roll();
+      damage = atk->damage->roll(d->combat_rng);
       io_queue_message("%s%s %s your %s for %d.", is_unique(atk) ? "" : "The ",
-                       atk->name, attacks[rand() % (sizeof (attacks) /
-                                                    sizeof (attacks[0]))],
-                       organs[rand() % (sizeof (organs) /
-                                        sizeof (organs[0]))], damage);
+                       atk->name,
+                       attacks[d->combat_rng.under(sizeof (attacks) /
+                                                   sizeof (attacks[0]))],
+                       organs[d->combat_rng.under(sizeof (organs) /
+                                                  sizeof (organs[0]))], damage);
     } else {
       for (i = damage = 0; i < num_eq_slots; i++) {
         if (i == eq_slot_weapon && !d->PC->eq[i]) {
-          damage += atk->damage->roll();
+          damage += atk->damage->roll(d->combat_rng);
         } else if (d->PC->eq[i]) {
-          damage += d->PC->eq[i]->roll_dice();
+          damage += d->PC->eq[i]->roll_dice(d->combat_rng);
         }
       }
       io_queue_message("You hit %s%s for %d.", is_unique(def) ? "" : "the ",
@@ -111,8 +112,9 @@ void do_combat(dungeon *d, character *atk, character *def)
       if (atk != d->PC) {
         io_queue_message("You die.");
         io_queue_message("As %s%s eats your %s,", is_unique(atk) ? "" : "the ",
-                         atk->name, organs[rand() % (sizeof (organs) /
-                                                     sizeof (organs[0]))]);
+                         atk->name,
+                         organs[d->combat_rng.under(sizeof (organs) /
+                                                    sizeof (organs[0]))]);
         io_queue_message("   ...you wonder if there is an afterlife.");
         /* Queue an empty message, otherwise the game will not pause for *
          * player to see above.                                          */
@@ -127,6 +129,7 @@ void do_combat(dungeon *d, character *atk, character *def)
                                        character_get_ikills(def)));
       if (def != d->PC) {
         d->num_monsters--;
+        d->monsters.remove(def);
       }
       charpair(def->position) = NULL;
     } else {
@@ -138,7 +141,7 @@ void do_combat(dungeon *d, character *atk, character *def)
 void move_character(dungeon *d, character *c, pair_t next)
 {
   int can_see_atk, can_see_def;
-  pair_t displacement;
+  pair_t displacement, from;
   uint32_t found_cell;
   pair_t order[9] = {
     { -1, -1 },
@@ -171,12 +174,15 @@ void move_character(dungeon *d, character *c, pair_t next)
        * instead select a random square from the 8 surrounding    *
        * the target cell.  Keep doing it until either we swap or  *
        * find an empty one for the displacement.                  */
-      for (s = rand() % 9, found_cell = i = 0;
+      for (s = d->ai_rng.under(9), found_cell = i = 0;
            i < 9 && !found_cell; i++) {
         displacement[dim_y] = next[dim_y] + order[s % 9][dim_y];
         displacement[dim_x] = next[dim_x] + order[s % 9][dim_x];
         if (((npc *) charpair(next))->characteristics & NPC_PASS_WALL) {
-          if (!charpair(displacement) ||
+          /* Even a monster that passes through walls can't be shoved *
+           * into the dungeon's border and off the edge of the map.   */
+          if ((!charpair(displacement) &&
+               (mappair(displacement) != ter_wall_immutable)) ||
               (charpair(displacement) == c)) {
             found_cell = 1;
           }
@@ -219,16 +225,25 @@ void move_character(dungeon *d, character *c, pair_t next)
       charpair(next) = c;
       charpair(displacement)->position[dim_y] = displacement[dim_y];
       charpair(displacement)->position[dim_x] = displacement[dim_x];
+      d->monsters.moved(charpair(displacement), next);
+      from[dim_y] = c->position[dim_y];
+      from[dim_x] = c->position[dim_x];
       c->position[dim_y] = next[dim_y];
       c->position[dim_x] = next[dim_x];
+      d->monsters.moved(c, from);
     }
   } else {
     /* No character in new position. */
 
     d->character_map[c->position[dim_y]][c->position[dim_x]] = NULL;
+    from[dim_y] = c->position[dim_y];
+    from[dim_x] = c->position[dim_x];
     c->position[dim_y] = next[dim_y];
     c->position[dim_x] = next[dim_x];
     d->character_map[c->position[dim_y]][c->position[dim_x]] = c;
+    if (c != d->PC) {
+      d->monsters.moved(c, from);
+    }
   }
 
   if (c == d->PC) {
@@ -237,11 +252,37 @@ void move_character(dungeon *d, character *c, pair_t next)
   }
 }
 
-void do_moves(dungeon *d)
+/* One monster's turn, e, which has just come off the queue. */
+static void do_monster_move(dungeon *d, event *e)
 {
   pair_t next;
   character *c;
+
+  d->num_events++;
+  d->time = e->time;
+  if (e->type == event_character_turn) {
+    c = e->c;
+  }
+  if (!c->alive) {
+    if (d->character_map[c->position[dim_y]][c->position[dim_x]] == c) {
+      d->character_map[c->position[dim_y]][c->position[dim_x]] = NULL;
+    }
+    if (c != d->PC) {
+      event_delete(d, e);
+    }
+    return;
+  }
+
+  npc_next_pos(d, (npc *) c, next);
+  move_character(d, (npc *) c, next);
+
+  event_queue_insert(&d->events, update_event(d, e, 1000 / c->speed));
+}
+
+void do_moves(dungeon *d)
+{
   event *e;
+  uint32_t i, allocations, pc_turn;
 
   /* Remove the PC when it is PC turn.  Replace on next call.  This allows *
    * use to completely uninit the heap when generating a new level without *
@@ -249,9 +290,9 @@ void do_moves(dungeon *d)
 
   if (pc_is_alive(d)) {
     /* The PC always goes first one a tie, so we don't use new_event().  *
-     * We generate one manually so that we can set the PC sequence       *
-     * number to zero.                                                   */
-    e = (event *) malloc(sizeof (*e));
+     * Its event is the dungeon's own, re-keyed here every turn, so that *
+     * we can set the PC sequence number to zero.                        */
+    e = &d->pc_event;
     e->type = event_character_turn;
     /* Hack: New dungeons are marked.  Unmark and ensure PC goes at d->time, *
      * otherwise, monsters get a turn before the PC.                         */
@@ -263,41 +304,49 @@ void do_moves(dungeon *d)
     }
     e->sequence = 0;
     e->c = d->PC;
-    heap_insert(&d->events, e);
+    event_queue_insert(&d->events, e);
   }
 
-  while (pc_is_alive(d) &&
-         (e = (event *) heap_remove_min(&d->events)) &&
-         ((e->type != event_character_turn) || (e->c != d->PC))) {
-    d->time = e->time;
-    if (e->type == event_character_turn) {
-      c = e->c;
+  /* Monsters' turns only ever re-key their own events. */
+  allocations = d->event_allocations;
+
+  /* Everything due at the same time comes off the queue in one go,  *
+   * into d->batch, and takes its turn in sequence order, exactly as *
+   * if it had come off one event at a time.  Each monster's event   *
+   * goes back on as soon as it has moved, later than the batch, so  *
+   * the sequence numbers come out the same, too.  The PC's turn is  *
+   * always first in its batch, and ends this, as does the PC dying; *
+   * whatever hasn't had its turn by then goes back on the queue.    *
+   * With d->ai_threads, the monsters ahead of the PC all plan their *
+   * moves first, at once (npc_plan_moves()), and then make them.    */
+  e = NULL;
+  pc_turn = 0;
+  while (pc_is_alive(d) && !pc_turn &&
+         event_queue_remove_slice(&d->events, d->batch)) {
+    d->num_batches++;
+    if (d->ai_threads) {
+      npc_plan_moves(d, d->batch);
     }
-    if (!c->alive) {
-      if (d->character_map[c->position[dim_y]][c->position[dim_x]] == c) {
-        d->character_map[c->position[dim_y]][c->position[dim_x]] = NULL;
-      }
-      if (c != d->PC) {
-        event_delete(e);
+    for (i = 0; i < d->batch.size() && pc_is_alive(d); i++) {
+      e = d->batch[i];
+      if (e->type == event_character_turn && e->c == d->PC) {
+        pc_turn = 1;
+        i++;
+        break;
       }
-      continue;
+      do_monster_move(d, e);
+    }
+    for (; i < d->batch.size(); i++) {
+      event_queue_insert(&d->events, d->batch[i]);
     }
-
-    npc_next_pos(d, (npc *) c, next);
-    move_character(d, (npc *) c, next);
-
-    heap_insert(&d->events, update_event(d, e, 1000 / c->speed));
   }
 
+  assert(d->event_allocations == allocations);
+
   io_display(d);
-  if (pc_is_alive(d) && e->c == d->PC) {
-    c = e->c;
+  if (pc_is_alive(d) && pc_turn) {
+    d->num_events++;
     d->time = e->time;
-    /* Kind of kludgey, but because the PC is never in the queue when   *
-     * we are outside of this function, the PC event has to get deleted *
-     * and recreated every time we leave and re-enter this function.    */
-    e->c = NULL;
-    event_delete(e);
     io_handle_input(d);
   }
 }
@@ -306,40 +355,36 @@ void dir_nearest_wall(dungeon *d, character *c, pair_t dir)
 {
   dir[dim_x] = dir[dim_y] = 0;
 
-  if (c->position[dim_x] != 1 && c->position[dim_x] != DUNGEON_X - 2) {
-    dir[dim_x] = (c->position[dim_x] > DUNGEON_X - c->position[dim_x] ? 1 : -1);
+  if (c->position[dim_x] != 1 && c->position[dim_x] != d->width - 2) {
+    dir[dim_x] = (c->position[dim_x] > d->width - c->position[dim_x] ? 1 : -1);
   }
-  if (c->position[dim_y] != 1 && c->position[dim_y] != DUNGEON_Y - 2) {
-    dir[dim_y] = (c->position[dim_y] > DUNGEON_Y - c->position[dim_y] ? 1 : -1);
+  if (c->position[dim_y] != 1 && c->position[dim_y] != d->height - 2) {
+    dir[dim_y] = (c->position[dim_y] > d->height - c->position[dim_y] ? 1 : -1);
   }
 }
 
+/* The four orthogonal neighbors in a bitmap::neighborhood(). */
+#define ORTHOGONAL_NEIGHBORS ((1 << 1) | (1 << 3) | (1 << 5) | (1 << 7))
+
 uint32_t against_wall(dungeon *d, character *c)
 {
-  return ((mapxy(c->position[dim_x] - 1,
-                 c->position[dim_y]    ) == ter_wall_immutable) ||
-          (mapxy(c->position[dim_x] + 1,
-                 c->position[dim_y]    ) == ter_wall_immutable) ||
-          (mapxy(c->position[dim_x]    ,
-                 c->position[dim_y] - 1) == ter_wall_immutable) ||
-          (mapxy(c->position[dim_x]    ,
-                 c->position[dim_y] + 1) == ter_wall_immutable));
+  terrain_layers_update(d);
+
+  return !!(d->immutable.neighborhood(c->position[dim_y],
+                                      c->position[dim_x]) &
+            ORTHOGONAL_NEIGHBORS);
 }
 
 uint32_t in_corner(dungeon *d, character *c)
 {
   uint32_t num_immutable;
 
-  num_immutable = 0;
+  terrain_layers_update(d);
 
-  num_immutable += (mapxy(c->position[dim_x] - 1,
-                          c->position[dim_y]    ) == ter_wall_immutable);
-  num_immutable += (mapxy(c->position[dim_x] + 1,
-                          c->position[dim_y]    ) == ter_wall_immutable);
-  num_immutable += (mapxy(c->position[dim_x]    ,
-                          c->position[dim_y] - 1) == ter_wall_immutable);
-  num_immutable += (mapxy(c->position[dim_x]    ,
-                          c->position[dim_y] + 1) == ter_wall_immutable);
+  num_immutable = __builtin_popcount(d->immutable.neighborhood(
+                                       c->position[dim_y],
+                                       c->position[dim_x]) &
+                                     ORTHOGONAL_NEIGHBORS);
 
   return num_immutable > 1;
 }
@@ -437,14 +482,13 @@ uint32_t move_pc(dungeon *d, uint32_t dir)
 
   if ((dir != '>') && (dir != '<') && (mappair(next) >= ter_floor)) {
     move_character(d, d->PC, next);
-    dijkstra(d);
-    dijkstra_tunnel(d);
+    path_pc_moved(d);
     d->PC->pick_up(d);
 
     return 0;
   } else if (mappair(next) < ter_floor) {
-    io_queue_message(wallmsg[rand() % (sizeof (wallmsg) /
-                                       sizeof (wallmsg[0]))]);
+    io_queue_message(wallmsg[d->ai_rng.under(sizeof (wallmsg) /
+                                             sizeof (wallmsg[0]))]);
     io_display(d);
   }
 
@@ -1,5 +1,9 @@
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <utility>
 
 #include "utils.h"
 #include "npc.h"
@@ -9,6 +13,7 @@
 #include "path.h"
 #include "event.h"
 #include "pc.h"
+#include "work_pool.h"
 
 static uint32_t max_monster_cells(dungeon *d)
 {
@@ -99,6 +104,56 @@ void gen_stronger_mon(dungeon *d)
 }
 
 
+/* Monsters planning in parallel can't share ai_rng: which thread *
+ * drew first would change the game.                              */
+static inline rng &npc_rng(dungeon *d, npc *c)
+{
+  return c->plan ? c->plan->r : d->ai_rng;
+}
+
+/* c, at next, tunnels into n: rock that's soft enough is dug out and   *
+ * stepped into, and anything harder is only softened, leaving c where  *
+ * it is.  A plan made in parallel can't change the map, so it only     *
+ * notes the cell, and npc_next_pos() digs when the monster's turn      *
+ * comes, in whatever the rock is like by then.                         */
+static void npc_tunnel(dungeon *d, npc *c, pair_t &n, pair_t next)
+{
+  if (d->planning)
+  {
+    c->plan->dig[dim_x] = n[dim_x];
+    c->plan->dig[dim_y] = n[dim_y];
+    c->plan->digs = 1;
+    if (hardnesspair(n) <= 85)
+    {
+      next[dim_x] = n[dim_x];
+      next[dim_y] = n[dim_y];
+    }
+    return;
+  }
+
+  if (hardnesspair(n) <= 85)
+  {
+    if (hardnesspair(n))
+    {
+      hardnesspair(n) = 0;
+      mappair(n) = ter_floor_hall;
+
+      /* Update distance maps because map has changed. */
+      path_terrain_changed(d, &n, 1);
+    }
+
+    next[dim_x] = n[dim_x];
+    next[dim_y] = n[dim_y];
+  }
+  else
+  {
+    hardnesspair(n) -= 85;
+
+    /* Softer rock makes tunneling through it cheaper. */
+    path_terrain_changed(d, &n, 1);
+  }
+}
+
 void npc_next_pos_rand_tunnel(dungeon *d, npc *c, pair_t next)
 {
   pair_t n;
@@ -108,11 +163,12 @@ void npc_next_pos_rand_tunnel(dungeon *d, npc *c, pair_t next)
     uint8_t a[4];
   } r;
 
+  terrain_layers_update(d);
   do
   {
     n[dim_y] = next[dim_y];
     n[dim_x] = next[dim_x];
-    r.i = rand();
+    r.i = npc_rng(d, c).next();
     if (r.a[0] > 85 /* 255 / 3 */)
     {
       if (r.a[0] & 1)
@@ -135,27 +191,9 @@ void npc_next_pos_rand_tunnel(dungeon *d, npc *c, pair_t next)
         n[dim_x]++;
       }
     }
-  } while (mappair(n) == ter_wall_immutable);
+  } while (immutablepair(n));
 
-  if (hardnesspair(n) <= 85)
-  {
-    if (hardnesspair(n))
-    {
-      hardnesspair(n) = 0;
-      mappair(n) = ter_floor_hall;
-
-      /* Update distance maps because map has changed. */
-      dijkstra(d);
-      dijkstra_tunnel(d);
-    }
-
-    next[dim_x] = n[dim_x];
-    next[dim_y] = n[dim_y];
-  }
-  else
-  {
-    hardnesspair(n) -= 85;
-  }
+  npc_tunnel(d, c, n, next);
 }
 
 void npc_next_pos_rand(dungeon *d, npc *c, pair_t next)
@@ -167,11 +205,12 @@ void npc_next_pos_rand(dungeon *d, npc *c, pair_t next)
     uint8_t a[4];
   } r;
 
+  terrain_layers_update(d);
   do
   {
     n[dim_y] = next[dim_y];
     n[dim_x] = next[dim_x];
-    r.i = rand();
+    r.i = npc_rng(d, c).next();
     if (r.a[0] > 85 /* 255 / 3 */)
     {
       if (r.a[0] & 1)
@@ -194,7 +233,7 @@ void npc_next_pos_rand(dungeon *d, npc *c, pair_t next)
         n[dim_x]++;
       }
     }
-  } while (mappair(n) < ter_floor);
+  } while (!walkablepair(n));
 
   next[dim_y] = n[dim_y];
   next[dim_x] = n[dim_x];
@@ -209,11 +248,12 @@ void npc_next_pos_rand_pass(dungeon *d, character *c, pair_t next)
     uint8_t a[4];
   } r;
 
+  terrain_layers_update(d);
   do
   {
     n[dim_y] = next[dim_y];
     n[dim_x] = next[dim_x];
-    r.i = rand();
+    r.i = npc_rng(d, (npc *) c).next();
     if (r.a[0] > 85 /* 255 / 3 */)
     {
       if (r.a[0] & 1)
@@ -236,7 +276,7 @@ void npc_next_pos_rand_pass(dungeon *d, character *c, pair_t next)
         n[dim_x]++;
       }
     }
-  } while (mappair(n) == ter_wall_immutable);
+  } while (immutablepair(n));
 
   next[dim_y] = n[dim_y];
   next[dim_x] = n[dim_x];
@@ -264,17 +304,17 @@ void npc_next_pos_line_of_sight(dungeon *d, character *c, pair_t next)
   }
   else
   {
-    if (mapxy(next[dim_x] + dir[dim_x],
-              next[dim_y] + dir[dim_y]) >= ter_floor)
+    terrain_layers_update(d);
+    if (walkablexy(next[dim_x] + dir[dim_x], next[dim_y] + dir[dim_y]))
     {
       next[dim_x] += dir[dim_x];
       next[dim_y] += dir[dim_y];
     }
-    else if (mapxy(next[dim_x] + dir[dim_x], next[dim_y]) >= ter_floor)
+    else if (walkablexy(next[dim_x] + dir[dim_x], next[dim_y]))
     {
       next[dim_x] += dir[dim_x];
     }
-    else if (mapxy(next[dim_x], next[dim_y] + dir[dim_y]) >= ter_floor)
+    else if (walkablexy(next[dim_x], next[dim_y] + dir[dim_y]))
     {
       next[dim_y] += dir[dim_y];
     }
@@ -299,164 +339,124 @@ void npc_next_pos_line_of_sight_tunnel(dungeon *d, npc *c, pair_t next)
   dir[dim_x] += next[dim_x];
   dir[dim_y] += next[dim_y];
 
-  if (hardnesspair(dir) <= 85)
-  {
-    if (hardnesspair(dir))
-    {
-      hardnesspair(dir) = 0;
-      mappair(dir) = ter_floor_hall;
-
-      /* Update distance maps because map has changed. */
-      dijkstra(d);
-      dijkstra_tunnel(d);
-    }
+  npc_tunnel(d, c, dir, next);
+}
 
-    next[dim_x] = dir[dim_x];
-    next[dim_y] = dir[dim_y];
-  }
-  else
-  {
-    hardnesspair(dir) -= 85;
-  }
+/* What it costs a tunneler to get to the goal of map t through (y, x), *
+ * in 64 bits so that a neighbor at infinity can't wrap around to look  *
+ * close.                                                               */
+static uint64_t tunnel_cost(dungeon *d, distance_map &t, int16_t y, int16_t x)
+{
+  return (uint64_t) t.get(y, x) + d->hardness[y][x] / 85;
 }
 
-void npc_next_pos_gradient(dungeon *d, npc *c, pair_t next)
+/* Moves c downhill on distance map w, or on t if c tunnels. */
+static void npc_descend(dungeon *d, npc *c, pair_t next,
+                        distance_map &w, distance_map &t)
 {
   /* Handles both tunneling and non-tunneling versions */
   pair_t min_next;
-  uint16_t min_cost;
+  uint64_t min_cost;
+
   if (c->characteristics & NPC_TUNNEL)
   {
-    min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x]] +
-                (d->hardness[next[dim_y] - 1][next[dim_x]] / 85));
+    min_cost = tunnel_cost(d, t, next[dim_y] - 1, next[dim_x]);
     min_next[dim_x] = next[dim_x];
     min_next[dim_y] = next[dim_y] - 1;
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x]] +
-         (d->hardness[next[dim_y] + 1][next[dim_x]] / 85)) < min_cost)
+    if (tunnel_cost(d, t, next[dim_y] + 1, next[dim_x]) < min_cost)
     {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x]] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x]] / 85));
+      min_cost = tunnel_cost(d, t, next[dim_y] + 1, next[dim_x]);
       min_next[dim_x] = next[dim_x];
       min_next[dim_y] = next[dim_y] + 1;
     }
-    if ((d->pc_tunnel[next[dim_y]][next[dim_x] + 1] +
-         (d->hardness[next[dim_y]][next[dim_x] + 1] / 85)) < min_cost)
+    if (tunnel_cost(d, t, next[dim_y], next[dim_x] + 1) < min_cost)
     {
-      min_cost = (d->pc_tunnel[next[dim_y]][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y]][next[dim_x] + 1] / 85));
+      min_cost = tunnel_cost(d, t, next[dim_y], next[dim_x] + 1);
       min_next[dim_x] = next[dim_x] + 1;
       min_next[dim_y] = next[dim_y];
     }
-    if ((d->pc_tunnel[next[dim_y]][next[dim_x] - 1] +
-         (d->hardness[next[dim_y]][next[dim_x] - 1] / 85)) < min_cost)
+    if (tunnel_cost(d, t, next[dim_y], next[dim_x] - 1) < min_cost)
     {
-      min_cost = (d->pc_tunnel[next[dim_y]][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y]][next[dim_x] - 1] / 85));
+      min_cost = tunnel_cost(d, t, next[dim_y], next[dim_x] - 1);
       min_next[dim_x] = next[dim_x] - 1;
       min_next[dim_y] = next[dim_y];
     }
-    if ((d->pc_tunnel[next[dim_y] - 1][next[dim_x] + 1] +
-         (d->hardness[next[dim_y] - 1][next[dim_x] + 1] / 85)) < min_cost)
+    if (tunnel_cost(d, t, next[dim_y] - 1, next[dim_x] + 1) < min_cost)
     {
-      min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y] - 1][next[dim_x] + 1] / 85));
+      min_cost = tunnel_cost(d, t, next[dim_y] - 1, next[dim_x] + 1);
       min_next[dim_x] = next[dim_x] + 1;
       min_next[dim_y] = next[dim_y] - 1;
     }
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x] + 1] +
-         (d->hardness[next[dim_y] + 1][next[dim_x] + 1] / 85)) < min_cost)
+    if (tunnel_cost(d, t, next[dim_y] + 1, next[dim_x] + 1) < min_cost)
     {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x] + 1] / 85));
+      min_cost = tunnel_cost(d, t, next[dim_y] + 1, next[dim_x] + 1);
       min_next[dim_x] = next[dim_x] + 1;
       min_next[dim_y] = next[dim_y] + 1;
     }
-    if ((d->pc_tunnel[next[dim_y] - 1][next[dim_x] - 1] +
-         (d->hardness[next[dim_y] - 1][next[dim_x] - 1] / 85)) < min_cost)
+    if (tunnel_cost(d, t, next[dim_y] - 1, next[dim_x] - 1) < min_cost)
     {
-      min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y] - 1][next[dim_x] - 1] / 85));
+      min_cost = tunnel_cost(d, t, next[dim_y] - 1, next[dim_x] - 1);
       min_next[dim_x] = next[dim_x] - 1;
       min_next[dim_y] = next[dim_y] - 1;
     }
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x] - 1] +
-         (d->hardness[next[dim_y] + 1][next[dim_x] - 1] / 85)) < min_cost)
+    if (tunnel_cost(d, t, next[dim_y] + 1, next[dim_x] - 1) < min_cost)
     {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x] - 1] / 85));
+      min_cost = tunnel_cost(d, t, next[dim_y] + 1, next[dim_x] - 1);
       min_next[dim_x] = next[dim_x] - 1;
       min_next[dim_y] = next[dim_y] + 1;
     }
-    if (hardnesspair(min_next) <= 85)
-    {
-      if (hardnesspair(min_next))
-      {
-        hardnesspair(min_next) = 0;
-        mappair(min_next) = ter_floor_hall;
-
-        /* Update distance maps because map has changed. */
-        dijkstra(d);
-        dijkstra_tunnel(d);
-      }
-
-      next[dim_x] = min_next[dim_x];
-      next[dim_y] = min_next[dim_y];
-    }
-    else
-    {
-      hardnesspair(min_next) -= 85;
-    }
+    npc_tunnel(d, c, min_next, next);
   }
   else
   {
     /* Make monsters prefer cardinal directions */
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x]] <
-        d->pc_distance[next[dim_y]][next[dim_x]])
+    if (w.get(next[dim_y] - 1, next[dim_x]) <
+        w.get(next[dim_y], next[dim_x]))
     {
       next[dim_y]--;
       return;
     }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x]] <
-        d->pc_distance[next[dim_y]][next[dim_x]])
+    if (w.get(next[dim_y] + 1, next[dim_x]) <
+        w.get(next[dim_y], next[dim_x]))
     {
       next[dim_y]++;
       return;
     }
-    if (d->pc_distance[next[dim_y]][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]])
+    if (w.get(next[dim_y], next[dim_x] + 1) <
+        w.get(next[dim_y], next[dim_x]))
     {
       next[dim_x]++;
       return;
     }
-    if (d->pc_distance[next[dim_y]][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]])
+    if (w.get(next[dim_y], next[dim_x] - 1) <
+        w.get(next[dim_y], next[dim_x]))
     {
       next[dim_x]--;
       return;
     }
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]])
+    if (w.get(next[dim_y] - 1, next[dim_x] + 1) <
+        w.get(next[dim_y], next[dim_x]))
     {
       next[dim_y]--;
       next[dim_x]++;
       return;
     }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]])
+    if (w.get(next[dim_y] + 1, next[dim_x] + 1) <
+        w.get(next[dim_y], next[dim_x]))
     {
       next[dim_y]++;
       next[dim_x]++;
       return;
     }
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]])
+    if (w.get(next[dim_y] - 1, next[dim_x] - 1) <
+        w.get(next[dim_y], next[dim_x]))
     {
       next[dim_y]--;
       next[dim_x]--;
       return;
     }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]])
+    if (w.get(next[dim_y] + 1, next[dim_x] - 1) <
+        w.get(next[dim_y], next[dim_x]))
     {
       next[dim_y]++;
       next[dim_x]--;
@@ -465,352 +465,328 @@ void npc_next_pos_gradient(dungeon *d, npc *c, pair_t next)
   }
 }
 
-static void npc_next_pos_00(dungeon *d, npc *c, pair_t next)
+void npc_next_pos_gradient(dungeon *d, npc *c, pair_t next)
 {
-  /* not smart; not telepathic; not tunneling; not erratic */
-  if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0))
-  {
-    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-    npc_next_pos_line_of_sight(d, c, next);
-  }
-  else
-  {
-    npc_next_pos_rand(d, c, next);
-  }
+  path_update(d);
+  npc_descend(d, c, next, d->pc_distance, d->pc_tunnel);
 }
 
-static void npc_next_pos_01(dungeon *d, npc *c, pair_t next)
+/* A smart monster that loses sight of the PC heads for where it last    *
+ * saw it.  Stepping straight at that spot, as the monster does while it *
+ * can see the PC, walks it into whatever walls are in between.  So all  *
+ * the monsters hunting like this share one distance map per kind of     *
+ * movement, with every one of their spots as a goal, built at most once *
+ * per game turn and change of terrain.  A monster follows it to the     *
+ * nearest spot, usually its own, and gives up when it gets to one or    *
+ * when none can be reached.                                             */
+static distance_map &hunt_map(dungeon *d, uint32_t tunnel)
 {
-  /*     smart; not telepathic; not tunneling; not erratic */
-  if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0))
-  {
-    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-    c->have_seen_pc = 1;
-    npc_next_pos_line_of_sight(d, c, next);
-  }
-  else if (c->have_seen_pc)
-  {
-    npc_next_pos_line_of_sight(d, c, next);
-  }
+  goal_map_t *g;
+  uint32_t i, n;
+  npc *m;
 
-  if (c->have_seen_pc &&
-      (next[dim_x] == c->pc_last_known_position[dim_x]) &&
-      (next[dim_y] == c->pc_last_known_position[dim_y]))
-  {
-    c->have_seen_pc = 0;
+  g = tunnel ? &d->hunt_tunnel : &d->hunt_walk;
+  if (g->time == d->time && g->terrain_generation == d->terrain_generation) {
+    return g->dist;
   }
-}
-
-static void npc_next_pos_02(dungeon *d, npc *c, pair_t next)
-{
-  /* not smart;     telepathic; not tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-  c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-  npc_next_pos_line_of_sight(d, c, next);
-}
 
-static void npc_next_pos_03(dungeon *d, npc *c, pair_t next)
-{
-  /*     smart;     telepathic; not tunneling; not erratic */
-  npc_next_pos_gradient(d, c, next);
-}
+  /* npc_plan_moves() builds it first, when it's going to be needed. */
+  assert(!d->planning);
 
-static void npc_next_pos_04(dungeon *d, npc *c, pair_t next)
-{
-  /* not smart; not telepathic;     tunneling; not erratic */
-  if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0))
-  {
-    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-    npc_next_pos_line_of_sight(d, c, next);
-  }
-  else
-  {
-    npc_next_pos_rand_tunnel(d, c, next);
+  if (g->goals_size < d->monsters.size()) {
+    g->goals_size = d->monsters.size();
+    g->goals = (pair_t *) realloc(g->goals,
+                                  g->goals_size * sizeof (*g->goals));
   }
-}
-
-static void npc_next_pos_05(dungeon *d, npc *c, pair_t next)
-{
-  /*     smart; not telepathic;     tunneling; not erratic */
-  if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0))
-  {
-    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-    c->have_seen_pc = 1;
-    npc_next_pos_line_of_sight(d, c, next);
+  for (n = i = 0; i < d->monsters.size(); i++) {
+    m = (npc *) d->monsters[i];
+    if (m->have_seen_pc) {
+      g->goals[n][dim_x] = m->pc_last_known_position[dim_x];
+      g->goals[n][dim_y] = m->pc_last_known_position[dim_y];
+      n++;
+    }
   }
-  else if (c->have_seen_pc)
-  {
-    npc_next_pos_line_of_sight_tunnel(d, c, next);
+  if (tunnel) {
+    dijkstra_tunnel_goals(d, g->dist, g->goals, n);
+  } else {
+    dijkstra_goals(d, g->dist, g->goals, n);
   }
 
-  if (c->have_seen_pc &&
-      (next[dim_x] == c->pc_last_known_position[dim_x]) &&
-      (next[dim_y] == c->pc_last_known_position[dim_y]))
-  {
-    c->have_seen_pc = 0;
-  }
-}
+  g->time = d->time;
+  g->terrain_generation = d->terrain_generation;
 
-static void npc_next_pos_06(dungeon *d, npc *c, pair_t next)
-{
-  /* not smart;     telepathic;     tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
-  c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
-  npc_next_pos_line_of_sight_tunnel(d, c, next);
+  return g->dist;
 }
 
-static void npc_next_pos_07(dungeon *d, npc *c, pair_t next)
+static void npc_next_pos_hunt(dungeon *d, npc *c, pair_t next)
 {
-  /*     smart;     telepathic;     tunneling; not erratic */
-  npc_next_pos_gradient(d, c, next);
-}
+  distance_map &h = hunt_map(d, c->characteristics & NPC_TUNNEL);
 
-static void npc_next_pos_erratic(dungeon *d, npc *c, pair_t next);
-
-static void npc_next_pos_10(dungeon *d, npc *c, pair_t next)
-{
-  npc_next_pos_00(d, c, next);
+  if (h.get(next[dim_y], next[dim_x]) == h.infinity()) {
+    c->have_seen_pc = 0;
+    return;
+  }
+  npc_descend(d, c, next, h, h);
+  if (!h.get(next[dim_y], next[dim_x])) {
+    c->have_seen_pc = 0;
+  }
 }
 
-static void npc_next_pos_11(dungeon *d, npc *c, pair_t next)
+/* A monster's move, given the abilities that decide it.  There's an    *
+ * instance for every combination of NPC_MOVE_ABILITIES, each with the  *
+ * tests of abilities folded away, so a monster gets code as straight   *
+ * as if its combination were written out by hand.  A new way to move   *
+ * is a new bit in NPC_MOVE_ABILITIES and a test of it here.            *
+ *                                                                      *
+ * Erratic monsters move at random half the time.  Smart telepaths      *
+ * take the shortest path to the PC; other telepaths head straight for  *
+ * it, digging if they tunnel.  Everybody else goes for the PC when     *
+ * they can see it.  When they can't, smart ones go after where they    *
+ * last saw it, and the rest wander.  Walls don't stop monsters that    *
+ * pass through them, so those never need to dig or hunt.               */
+template <npc_characteristics_t abilities>
+static void npc_next_pos_kernel(dungeon *d, npc *c, pair_t next)
 {
-  /* pass wall;     smart; not telepathic; not tunneling; not erratic */
-  if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0))
+  const bool smart = abilities & NPC_SMART;
+  const bool telepath = abilities & NPC_TELEPATH;
+  const bool tunnel = abilities & NPC_TUNNEL;
+  const bool erratic = abilities & NPC_ERRATIC;
+  const bool pass_wall = abilities & NPC_PASS_WALL;
+
+  if (erratic && (npc_rng(d, c).next() & 1))
   {
-    c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-    c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-    c->have_seen_pc = 1;
-    npc_next_pos_line_of_sight(d, c, next);
+    if (pass_wall)
+    {
+      npc_next_pos_rand_pass(d, c, next);
+    }
+    else
+    {
+      npc_next_pos_rand(d, c, next);
+    }
+    return;
   }
-  else if (c->have_seen_pc)
+
+  if (smart && telepath && !pass_wall)
   {
-    npc_next_pos_line_of_sight(d, c, next);
+    npc_next_pos_gradient(d, c, next);
+    return;
   }
 
-  if ((next[dim_x] == c->pc_last_known_position[dim_x]) &&
-      (next[dim_y] == c->pc_last_known_position[dim_y]))
+  if (telepath)
   {
-    c->have_seen_pc = 0;
+    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+    if (tunnel && !pass_wall)
+    {
+      npc_next_pos_line_of_sight_tunnel(d, c, next);
+    }
+    else
+    {
+      npc_next_pos_line_of_sight(d, c, next);
+    }
+    return;
   }
-}
-
-static void npc_next_pos_12(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall; not smart;     telepathic; not tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-  c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-  npc_next_pos_line_of_sight(d, c, next);
-}
 
-static void npc_next_pos_13(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall;     smart;     telepathic; not tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-  c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-  npc_next_pos_line_of_sight(d, c, next);
-}
-
-static void npc_next_pos_14(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall; not smart; not telepathic;     tunneling; not erratic */
   if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0))
   {
-    c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-    c->pc_last_known_position[dim_x] = character_get_x(d->PC);
+    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+    if (smart)
+    {
+      c->have_seen_pc = 1;
+    }
     npc_next_pos_line_of_sight(d, c, next);
   }
-  else
+  else if (smart)
   {
-    npc_next_pos_rand_pass(d, c, next);
+    if (c->have_seen_pc)
+    {
+      if (pass_wall)
+      {
+        npc_next_pos_line_of_sight(d, c, next);
+      }
+      else
+      {
+        npc_next_pos_hunt(d, c, next);
+      }
+    }
   }
-}
-
-static void npc_next_pos_15(dungeon *d, npc *c, pair_t next)
-{
-  npc_next_pos_11(d, c, next);
-}
-
-static void npc_next_pos_16(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall; not smart;     telepathic;     tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-  c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-  npc_next_pos_line_of_sight(d, c, next);
-}
-
-static void npc_next_pos_17(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall;     smart;     telepathic;     tunneling; not erratic */
-  c->pc_last_known_position[dim_y] = character_get_y(d->PC);
-  c->pc_last_known_position[dim_x] = character_get_x(d->PC);
-  npc_next_pos_line_of_sight(d, c, next);
-}
-
-static void npc_next_pos_18(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall; not smart; not telepathic; not tunneling;     erratic */
-  if (rand() & 1)
+  else if (tunnel && pass_wall)
   {
     npc_next_pos_rand_pass(d, c, next);
   }
-  else
-  {
-    npc_next_pos_10(d, c, next);
-  }
-}
-
-static void npc_next_pos_19(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall;     smart; not telepathic; not tunneling;     erratic */
-  if (rand() & 1)
+  else if (tunnel)
   {
-    npc_next_pos_rand_pass(d, c, next);
+    npc_next_pos_rand_tunnel(d, c, next);
   }
   else
   {
-    npc_next_pos_11(d, c, next);
+    npc_next_pos_rand(d, c, next);
   }
-}
 
-static void npc_next_pos_1a(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall; not smart;     telepathic; not tunneling;     erratic */
-  if (rand() & 1)
-  {
-    npc_next_pos_rand_pass(d, c, next);
-  }
-  else
+  /* Getting to where it last saw the PC ends the hunt. */
+  if (smart && (pass_wall || c->have_seen_pc) &&
+      (next[dim_x] == c->pc_last_known_position[dim_x]) &&
+      (next[dim_y] == c->pc_last_known_position[dim_y]))
   {
-    npc_next_pos_12(d, c, next);
+    c->have_seen_pc = 0;
   }
 }
 
-static void npc_next_pos_1b(dungeon *d, npc *c, pair_t next)
+/* Plans the moves of n monsters with the same abilities, in a loop *
+ * with the kernel inlined instead of called through a pointer.     */
+template <npc_characteristics_t abilities>
+static void npc_plan_kernel(dungeon *d, npc_plan_t *p, uint32_t n)
 {
-  /* pass wall;     smart;     telepathic; not tunneling;     erratic */
-  if (rand() & 1)
-  {
-    npc_next_pos_rand_pass(d, c, next);
-  }
-  else
+  for (; n; n--, p++)
   {
-    npc_next_pos_13(d, c, next);
+    npc_next_pos_kernel<abilities>(d, p->c, p->next);
   }
 }
 
-static void npc_next_pos_1c(dungeon *d, npc *c, pair_t next)
-{
-  /* pass wall; not smart; not telepathic;     tunneling;     erratic */
-  if (rand() & 1)
-  {
-    npc_next_pos_rand_pass(d, c, next);
-  }
-  else
-  {
-    npc_next_pos_14(d, c, next);
-  }
-}
+/* Both kernels for every combination of movement abilities, indexed by *
+ * characteristics & NPC_MOVE_ABILITIES.                                */
+template <typename> struct npc_kernels;
+template <npc_characteristics_t... abilities>
+struct npc_kernels<std::integer_sequence<npc_characteristics_t,
+                                         abilities...> > {
+  static constexpr void (*next_pos[])(dungeon *d, npc *c, pair_t next) = {
+    npc_next_pos_kernel<abilities>...
+  };
+  static constexpr void (*plan[])(dungeon *d, npc_plan_t *p, uint32_t n) = {
+    npc_plan_kernel<abilities>...
+  };
+};
+typedef npc_kernels<std::make_integer_sequence<npc_characteristics_t,
+                                               NPC_MOVE_ABILITIES + 1> >
+  npc_kernel;
 
-static void npc_next_pos_1d(dungeon *d, npc *c, pair_t next)
+void npc_next_pos(dungeon *d, npc *c, pair_t next)
 {
-  /* pass wall;     smart; not telepathic;     tunneling;     erratic */
-  if (rand() & 1)
+  npc_plan_t *p;
+
+  next[dim_y] = c->position[dim_y];
+  next[dim_x] = c->position[dim_x];
+
+  /* A plan stands as long as nothing has pushed the monster out of the *
+   * cell it planned from.  Otherwise it plans again, now, still with   *
+   * its own random numbers.                                            */
+  if ((p = c->plan) &&
+      p->from[dim_y] == c->position[dim_y] &&
+      p->from[dim_x] == c->position[dim_x])
   {
-    npc_next_pos_rand_pass(d, c, next);
+    if (p->digs)
+    {
+      npc_tunnel(d, c, p->dig, next);
+    }
+    else
+    {
+      next[dim_y] = p->next[dim_y];
+      next[dim_x] = p->next[dim_x];
+    }
+    c->plan = NULL;
+    return;
   }
-  else
+  if (p)
   {
-    npc_next_pos_15(d, c, next);
+    d->replanned_moves++;
   }
+
+  npc_kernel::next_pos[c->characteristics & NPC_MOVE_ABILITIES](d, c, next);
+  c->plan = NULL;
 }
 
-static void npc_next_pos_1e(dungeon *d, npc *c, pair_t next)
+/* Long enough to make the loop worthwhile, short enough that one class *
+ * of monster can still be spread over the threads.                     */
+#define NPC_PLAN_RUN_MAX 16
+
+static bool npc_plan_before(const npc_plan_t &p, const npc_plan_t &q)
 {
-  /* pass wall; not smart;     telepathic;     tunneling;     erratic */
-  if (rand() & 1)
-  {
-    npc_next_pos_rand_pass(d, c, next);
-  }
-  else
-  {
-    npc_next_pos_16(d, c, next);
-  }
+  return ((p.c->characteristics & NPC_MOVE_ABILITIES) <
+          (q.c->characteristics & NPC_MOVE_ABILITIES));
 }
 
-static void npc_next_pos_1f(dungeon *d, npc *c, pair_t next)
+static void npc_plan(void *v, uint32_t i)
 {
-  /* pass wall;     smart;     telepathic;     tunneling;     erratic */
-  if (rand() & 1)
-  {
-    npc_next_pos_rand_pass(d, c, next);
-  }
-  else
-  {
-    npc_next_pos_17(d, c, next);
-  }
+  dungeon *d = (dungeon *) v;
+  npc_plan_t *p = &d->plans[d->plan_runs[i].first];
+
+  npc_kernel::plan[p->c->characteristics & NPC_MOVE_ABILITIES]
+    (d, p, d->plan_runs[i].count);
 }
 
-void (*npc_move_func[])(dungeon *d, npc *c, pair_t next) = {
-    /* We'll have one function for each combination of bits, so the *
-   * order is based on binary counting through the NPC_* bits.    *
-   * It could be very easy to mess this up, so be careful.  We'll *
-   * name them according to their hex value.                      */
-    npc_next_pos_00,
-    npc_next_pos_01,
-    npc_next_pos_02,
-    npc_next_pos_03,
-    npc_next_pos_04,
-    npc_next_pos_05,
-    npc_next_pos_06,
-    npc_next_pos_07,
-    npc_next_pos_erratic,
-    npc_next_pos_erratic,
-    npc_next_pos_erratic,
-    npc_next_pos_erratic,
-    npc_next_pos_erratic,
-    npc_next_pos_erratic,
-    npc_next_pos_erratic,
-    npc_next_pos_erratic,
-    npc_next_pos_10,
-    npc_next_pos_11,
-    npc_next_pos_12,
-    npc_next_pos_13,
-    npc_next_pos_14,
-    npc_next_pos_15,
-    npc_next_pos_16,
-    npc_next_pos_17,
-    npc_next_pos_18,
-    npc_next_pos_19,
-    npc_next_pos_1a,
-    npc_next_pos_1b,
-    npc_next_pos_1c,
-    npc_next_pos_1d,
-    npc_next_pos_1e,
-    npc_next_pos_1f};
-
-static void npc_next_pos_erratic(dungeon *d, npc *c, pair_t next)
+void npc_plan_moves(dungeon *d, std::vector<event *> &batch)
 {
-  /*                                               erratic */
-  if (rand() & 1)
+  std::vector<npc_plan_t> &plans = d->plans;
+  std::vector<npc_plan_run_t> &plan_runs = d->plan_runs;
+  uint32_t i, seed;
+  npc_plan_run_t run;
+  npc_plan_t *p;
+  npc *c;
+
+  if (!d->ai_pool)
   {
-    npc_next_pos_rand(d, c, next);
+    d->ai_pool = (work_pool_t *) malloc(sizeof (*d->ai_pool));
+    work_pool_init(d->ai_pool, d->ai_threads);
   }
-  else
+
+  /* Everything the plans read lazily has to be up to date before they *
+   * start, and stay that way until they're done: the terrain layers,  *
+   * the distance maps for the smart telepaths, and the hunting maps   *
+   * for the smart ones that have lost sight of the PC.                */
+  terrain_layers_update(d);
+  seed = d->ai_rng.next();
+  plans.clear();
+  for (i = 0; i < batch.size() && batch[i]->c != d->PC; i++)
   {
-    npc_move_func[c->characteristics & 0x00000007](d, c, next);
+    c = (npc *) batch[i]->c;
+    if (!c->alive)
+    {
+      continue;
+    }
+    switch (c->characteristics & (NPC_SMART | NPC_TELEPATH | NPC_PASS_WALL))
+    {
+    case NPC_SMART | NPC_TELEPATH:
+      path_update(d);
+      break;
+    case NPC_SMART:
+      if (c->have_seen_pc)
+      {
+        hunt_map(d, c->characteristics & NPC_TUNNEL);
+      }
+      break;
+    }
+    plans.push_back(npc_plan_t());
+    p = &plans.back();
+    p->c = c;
+    p->r.seed(seed, c->sequence_number);
+    p->from[dim_y] = p->next[dim_y] = c->position[dim_y];
+    p->from[dim_x] = p->next[dim_x] = c->position[dim_x];
+    p->digs = 0;
+  }
+
+  /* Plans don't depend on each other, so they can be made in any order; *
+   * monsters with the same abilities go together.                       */
+  std::stable_sort(plans.begin(), plans.end(), npc_plan_before);
+  plan_runs.clear();
+  for (i = 0; i < plans.size(); i++)
+  {
+    plans[i].c->plan = &plans[i];
+    if (plan_runs.empty() ||
+        plan_runs.back().count == NPC_PLAN_RUN_MAX ||
+        npc_plan_before(plans[i - 1], plans[i]))
+    {
+      run.first = i;
+      run.count = 0;
+      plan_runs.push_back(run);
+    }
+    plan_runs.back().count++;
   }
-}
-
-void npc_next_pos(dungeon *d, npc *c, pair_t next)
-{
-  next[dim_y] = c->position[dim_y];
-  next[dim_x] = c->position[dim_x];
 
-  npc_move_func[c->characteristics & 0x0000001f](d, c, next);
+  d->planning = 1;
+  work_pool_run(d->ai_pool, plan_runs.size(), npc_plan, d);
+  d->planning = 0;
+  d->planned_moves += plans.size();
 }
 
 uint32_t dungeon_has_npcs(dungeon *d)
@@ -829,13 +805,13 @@ npc::npc(dungeon *d, monster_description &m) : md(m)
   i = 0;
   do
   {
-    room = rand_range(1, d->num_rooms - 1);
-    p[dim_y] = rand_range(d->rooms[room].position[dim_y],
-                          (d->rooms[room].position[dim_y] +
-                           d->rooms[room].size[dim_y] - 1));
-    p[dim_x] = rand_range(d->rooms[room].position[dim_x],
-                          (d->rooms[room].position[dim_x] +
-                           d->rooms[room].size[dim_x] - 1));
+    room = d->map_rng.range(1, d->num_rooms - 1);
+    p[dim_y] = d->map_rng.range(d->rooms[room].position[dim_y],
+                                (d->rooms[room].position[dim_y] +
+                                 d->rooms[room].size[dim_y] - 1));
+    p[dim_x] = d->map_rng.range(d->rooms[room].position[dim_x],
+                                (d->rooms[room].position[dim_x] +
+                                 d->rooms[room].size[dim_x] - 1));
     i++;
   } while (d->character_map[p[dim_y]][p[dim_x]]);
   pc_last_known_position[dim_y] = p[dim_y];
@@ -843,13 +819,15 @@ npc::npc(dungeon *d, monster_description &m) : md(m)
   position[dim_y] = p[dim_y];
   position[dim_x] = p[dim_x];
   d->character_map[p[dim_y]][p[dim_x]] = this;
-  speed = m.speed.roll();
-  hp = m.hitpoints.roll();
+  d->monsters.add(this);
+  speed = m.speed.roll(d->map_rng);
+  hp = m.hitpoints.roll(d->map_rng);
   damage = &m.damage;
   alive = 1;
   sequence_number = ++d->character_sequence_number;
   characteristics = m.abilities;
   have_seen_pc = 0;
+  plan = NULL;
   name = m.name.c_str();
   description = (const char *)m.description.c_str();
   for (i = 0; i < num_kill_types; i++)
@@ -2,9 +2,11 @@
 # define NPC_H
 
 # include <stdint.h>
+# include <vector>
 
 # include "dims.h"
 # include "character.h"
+# include "rng.h"
 
 # define NPC_SMART         0x00000001
 # define NPC_TELEPATH      0x00000002
@@ -39,15 +41,41 @@
 # define NPC_BIT30         0x40000000
 # define NPC_BIT31         0x80000000
 
+/* The abilities that decide how a monster moves; see npc.cpp's    *
+ * npc_next_pos_kernel().  They have to be the lowest bits, since  *
+ * there's a kernel for every value up to this.                    */
+# define NPC_MOVE_ABILITIES (NPC_SMART | NPC_TELEPATH | NPC_TUNNEL |   \
+                             NPC_ERRATIC | NPC_PASS_WALL)
+
 # define has_characteristic(character, bit)              \
   (((npc *) character)->characteristics & NPC_##bit)
 # define is_unique(character) has_characteristic(character, UNIQ)
 # define is_boss(character) has_characteristic(character, BOSS)
 
 class monster_description;
+struct event;
+class npc;
 
 typedef uint32_t npc_characteristics_t;
 
+/* A monster's move planned in parallel with the others in its time     *
+ * slice (see npc_plan_moves()), against the dungeon as it was when the *
+ * slice began, and with random numbers of its own.                     */
+typedef struct npc_plan {
+  npc *c;
+  rng r;
+  pair_t from;
+  pair_t next;
+  pair_t dig;
+  uint32_t digs;
+} npc_plan_t;
+
+/* A stretch of plans, all for monsters with the same abilities. */
+typedef struct npc_plan_run {
+  uint32_t first;
+  uint32_t count;
+} npc_plan_run_t;
+
 class npc : public character {
  public:
   npc(dungeon *d, monster_description &m);
@@ -57,6 +85,8 @@ class npc : public character {
   pair_t pc_last_known_position;
   const char *description;
   monster_description &md;
+  /* This turn's move, while it's planned in parallel; otherwise NULL. */
+  struct npc_plan *plan;
 };
 
 void gen_monsters(dungeon *d);
@@ -64,6 +94,11 @@ void gen_stronger_mon(dungeon *d);
 void gen_weaker_mon(dungeon *d);
 void npc_delete(npc *n);
 void npc_next_pos(dungeon *d, npc *c, pair_t next);
+/* With d->ai_threads, plans the moves of the monsters in batch, up to *
+ * the PC's turn, on that many threads; npc_next_pos() commits them,   *
+ * one at a time, in order.  The game comes out the same regardless of *
+ * the number of threads, though not the same as without any.          */
+void npc_plan_moves(dungeon *d, std::vector<event *> &batch);
 uint32_t dungeon_has_npcs(dungeon *d);
 bool boss_is_alive(dungeon *d);
 
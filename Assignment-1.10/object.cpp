@@ -7,20 +7,20 @@
 #include "dungeon.h"
 #include "utils.h"
 
-object::object(object_description &o, pair_t p, object *next) :
+object::object(object_description &o, rng &r, pair_t p, object *next) :
   name(o.get_name()),
   description(o.get_description()),
   type(o.get_type()),
   color(o.get_color()),
   rarity(o.get_rarity()), //Lee's
   damage(o.get_damage()),
-  hit(o.get_hit().roll()),
-  dodge(o.get_dodge().roll()),
-  defence(o.get_defence().roll()),
-  weight(o.get_weight().roll()),
-  speed(o.get_speed().roll()),
-  attribute(o.get_attribute().roll()),
-  value(o.get_value().roll()),
+  hit(o.get_hit().roll(r)),
+  dodge(o.get_dodge().roll(r)),
+  defence(o.get_defence().roll(r)),
+  weight(o.get_weight().roll(r)),
+  speed(o.get_speed().roll(r)),
+  attribute(o.get_attribute().roll(r)),
+  value(o.get_value().roll(r)),
   seen(false),
   next(next),
   od(o)
@@ -32,20 +32,20 @@ object::object(object_description &o, pair_t p, object *next) :
 }
 
 //lee's
-object::object(object_description &o) :
+object::object(object_description &o, rng &r) :
   name(o.get_name()),
   description(o.get_description()),
   type(o.get_type()),
   color(o.get_color()),
   rarity(o.get_rarity()), //Lee's
   damage(o.get_damage()),
-  hit(o.get_hit().roll()),
-  dodge(o.get_dodge().roll()),
-  defence(o.get_defence().roll()),
-  weight(o.get_weight().roll()),
-  speed(o.get_speed().roll()),
-  attribute(o.get_attribute().roll()),
-  value(o.get_value().roll()),
+  hit(o.get_hit().roll(r)),
+  dodge(o.get_dodge().roll(r)),
+  defence(o.get_defence().roll(r)),
+  weight(o.get_weight().roll(r)),
+  speed(o.get_speed().roll(r)),
+  attribute(o.get_attribute().roll(r)),
+  value(o.get_value().roll(r)),
   seen(false),
   od(o)
 {
@@ -69,20 +69,20 @@ void gen_object(dungeon *d)
   int i;
 
   do {
-    i = rand_range(0, v.size() - 1);
-  } while (!v[i].can_be_generated() || !v[i].pass_rarity_roll());
+    i = d->loot_rng.under(v.size());
+  } while (!v[i].can_be_generated() || !v[i].pass_rarity_roll(d->loot_rng));
   
-  room = rand_range(0, d->num_rooms - 1);
+  room = d->loot_rng.under(d->num_rooms);
   do {
-    p[dim_y] = rand_range(d->rooms[room].position[dim_y],
-                          (d->rooms[room].position[dim_y] +
-                           d->rooms[room].size[dim_y] - 1));
-    p[dim_x] = rand_range(d->rooms[room].position[dim_x],
-                          (d->rooms[room].position[dim_x] +
-                           d->rooms[room].size[dim_x] - 1));
+    p[dim_y] = d->loot_rng.range(d->rooms[room].position[dim_y],
+                                 (d->rooms[room].position[dim_y] +
+                                  d->rooms[room].size[dim_y] - 1));
+    p[dim_x] = d->loot_rng.range(d->rooms[room].position[dim_x],
+                                 (d->rooms[room].position[dim_x] +
+                                  d->rooms[room].size[dim_x] - 1));
   } while (mappair(p) > ter_stairs);
 
-  o = new object(v[i], p, d->objmap[p[dim_y]][p[dim_x]]);
+  o = new object(v[i], d->loot_rng, p, d->objmap[p[dim_y]][p[dim_x]]);
 
   d->objmap[p[dim_y]][p[dim_x]] = o;
   
@@ -92,7 +92,7 @@ void gen_objects(dungeon *d)
 {
   uint32_t i;
 
-  memset(d->objmap, 0, sizeof (d->objmap));
+  d->objmap.fill(NULL);
 
   for (i = 0; i < d->max_objects; i++) {
     gen_object(d);
@@ -121,17 +121,17 @@ int32_t object::get_speed()
   return speed;
 }
 
-int32_t object::roll_dice()
+int32_t object::roll_dice(rng &r)
 {
-  return damage.roll();
+  return damage.roll(r);
 }
 
 void destroy_objects(dungeon *d)
 {
   uint32_t y, x;
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
       if (d->objmap[y][x]) {
         delete d->objmap[y][x];
         d->objmap[y][x] = 0;
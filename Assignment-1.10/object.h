@@ -21,8 +21,8 @@ class object {
   object *next;
   object_description &od;
  public:
-  object(object_description &o, pair_t p, object *next);
-  object(object_description &o);
+  object(object_description &o, rng &r, pair_t p, object *next);
+  object(object_description &o, rng &r);
   ~object();
   inline int32_t get_damage_base() const
   {
@@ -40,7 +40,7 @@ class object {
   uint32_t get_color();
   const char *get_name();
   int32_t get_speed();
-  int32_t roll_dice();
+  int32_t roll_dice(rng &r);
   int32_t get_type();
   bool have_seen() { return seen; }
   void has_been_seen() { seen = true; }
@@ -1,10 +1,512 @@
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
 
 #include "path.h"
+#include "bucket.h"
 #include "dungeon.h"
 #include "utils.h"
 #include "pc.h"
 
+/* The distance maps come in three cell widths (see distance.h).  Each *
+ * search below is written once, for cells of type T, and the public   *
+ * function picks the instance matching the map.                       */
+
+/* The eight neighbors of a cell, as (dy, dx).  With a map's cells    *
+ * numbered y * width + x, neighbor k of cell c is c + offset[k], and *
+ * neighbor_offsets() works out offset[] once per search.             */
+static constexpr int8_t neighbor_delta[8][2] = {
+  { -1, -1 }, { -1,  0 }, { -1,  1 },
+  {  0, -1 },             {  0,  1 },
+  {  1, -1 }, {  1,  0 }, {  1,  1 },
+};
+
+static void neighbor_offsets(dungeon *d, int32_t offset[8])
+{
+  uint32_t k;
+
+  for (k = 0; k < 8; k++) {
+    offset[k] = neighbor_delta[k][0] * d->width + neighbor_delta[k][1];
+  }
+}
+
+/* The terrain each kind of search can path through, as sets of bits *
+ * indexed by terrain_type.                                          */
+# define terrain_bit(t) (1U << (t))
+static constexpr uint32_t walk_terrain = ~(terrain_bit(ter_floor) - 1);
+static constexpr uint32_t tunnel_terrain = ~terrain_bit(ter_wall_immutable);
+
+/* The relaxation step every search below is built on.  Each neighbor  *
+ * of cell c that's in the passable set is offered a path through c,   *
+ * costing step more than c's own.  The ones that take it are written  *
+ * to improved[], and relax() returns how many there were.             *
+ *                                                                     *
+ * There are no bounds checks.  The outer ring of every dungeon is     *
+ * immutable wall (see seal_border()), which no search passes through, *
+ * so c is never on the edge and all eight neighbors exist.            *
+ *                                                                     *
+ * Sums are in 64 bits, so one that passes infinity compares as such   *
+ * for every width of T; a cell at infinity - 1 or more just never     *
+ * improves a neighbor.  The test itself is branch-free, but storing   *
+ * stays behind a branch: on the saved dungeons, storing every         *
+ * neighbor unconditionally was slower, since most of them are walls   *
+ * or already settled and the branch predicts well.                    */
+template <class T>
+static inline uint32_t relax(T *dist, const terrain_type *map, uint32_t c,
+                             const int32_t offset[8], uint32_t passable,
+                             uint32_t step, uint32_t *improved)
+  __attribute__ ((always_inline));
+
+template <class T>
+static inline uint32_t relax(T *dist, const terrain_type *map, uint32_t c,
+                             const int32_t offset[8], uint32_t passable,
+                             uint32_t step, uint32_t *improved)
+{
+  uint64_t through;
+  uint32_t k, n, num;
+
+  through = (uint64_t) dist[c] + step;
+  for (num = k = 0; k < 8; k++) {
+    n = c + offset[k];
+    if (((passable >> map[n]) & 1) & ((uint64_t) dist[n] > through)) {
+      dist[n] = through;
+      improved[num++] = n;
+    }
+  }
+
+  return num;
+}
+
+template <class T>
+static void dijkstra_cells(dungeon *d, grid<T> &dist,
+                           pair_t *goals, uint32_t num_goals)
+{
+  /* Currently assumes that monsters only move on floors.  Will *
+   * need to be modified for tunneling and pass-wall monsters.  */
+
+  /* Every move between floor cells costs 1, so a breadth-first search  *
+   * finds the same distances as Dijkstra's algorithm without a         *
+   * priority queue.  In that order, the first path relax() offers a    *
+   * cell is a shortest one, so each cell enters the frontier at most   *
+   * once, and a flat array of cell indices never needs to wrap.  It's  *
+   * the dungeon's, kept from call to call, and only grows.             */
+  std::vector<uint32_t> &frontier = d->path_frontier;
+  const T infinity = (T) -1;
+  int32_t offset[8];
+  uint32_t head, tail, c, n;
+
+  if (frontier.size() < dist.size()) {
+    frontier.resize(dist.size());
+  }
+  neighbor_offsets(d, offset);
+  dist.fill(infinity);
+
+  /* Every goal starts out in the frontier at distance 0, so each cell *
+   * ends up with its distance to the nearest one.                     */
+  for (head = tail = n = 0; n < num_goals; n++) {
+    c = goals[n][dim_y] * d->width + goals[n][dim_x];
+    if (dist.data()[c]) {
+      dist.data()[c] = 0;
+      frontier[tail++] = c;
+    }
+  }
+
+  while (head != tail) {
+    tail += relax(dist.data(), d->map.data(), frontier[head++], offset,
+                  walk_terrain, 1, &frontier[tail]);
+  }
+}
+
+void dijkstra_goals(dungeon *d, distance_map &dist,
+                    pair_t *goals, uint32_t num_goals)
+{
+  switch (dist.bytes()) {
+  case 1:
+    dijkstra_cells(d, dist.cells<uint8_t>(), goals, num_goals);
+    break;
+  case 2:
+    dijkstra_cells(d, dist.cells<uint16_t>(), goals, num_goals);
+    break;
+  default:
+    dijkstra_cells(d, dist.cells<uint32_t>(), goals, num_goals);
+    break;
+  }
+}
+
+void dijkstra(dungeon *d)
+{
+  dijkstra_goals(d, d->pc_distance, &d->PC->position, 1);
+}
+
+/* Ignores the case of hardness == 255, because if *
+ * that gets here, there's already been an error.  */
+#define tunnel_movement_cost(x, y)                      \
+  ((d->hardness[y][x] / 85) + 1)
+
+/* The same, for cell i of the linearized map. */
+#define tunnel_cell_cost(i)                             \
+  ((d->hardness.data()[i] / 85) + 1)
+
+template <class T>
+static void dijkstra_tunnel_cells(dungeon *d, grid<T> &dist,
+                                  pair_t *goals, uint32_t num_goals)
+{
+  /* Tunneling costs are small integers, so rather than a Fibonacci *
+   * heap, this uses a bucket queue (Dial's algorithm), indexed by  *
+   * the linearized cell position, y * width + x.  The queue is     *
+   * rebuilt whenever a bigger dungeon comes along.                 */
+
+  bucket_queue_t &q = d->path_queue;
+  const T infinity = (T) -1;
+  int32_t offset[8];
+  uint32_t c, i, k, n, num;
+  uint32_t improved[8];
+
+  if (q.capacity < dist.size()) {
+    if (q.capacity) {
+      bucket_queue_delete(&q);
+    }
+    bucket_queue_init(&q, dist.size(), TUNNEL_MAX_COST);
+  }
+  neighbor_offsets(d, offset);
+  dist.fill(infinity);
+
+  bucket_queue_reset(&q);
+  for (n = 0; n < num_goals; n++) {
+    c = goals[n][dim_y] * d->width + goals[n][dim_x];
+    if (dist.data()[c]) {
+      dist.data()[c] = 0;
+      bucket_queue_insert(&q, c, 0);
+    }
+  }
+
+  while ((c = bucket_queue_remove_min(&q)) != BUCKET_QUEUE_NONE) {
+    num = relax(dist.data(), d->map.data(), c, offset,
+                tunnel_terrain, tunnel_cell_cost(c), improved);
+    for (k = 0; k < num; k++) {
+      i = improved[k];
+      if (bucket_queue_contains(&q, i)) {
+        bucket_queue_decrease_key(&q, i, dist.data()[i]);
+      } else {
+        bucket_queue_insert(&q, i, dist.data()[i]);
+      }
+    }
+  }
+}
+
+void dijkstra_tunnel_goals(dungeon *d, distance_map &dist,
+                           pair_t *goals, uint32_t num_goals)
+{
+  switch (dist.bytes()) {
+  case 1:
+    dijkstra_tunnel_cells(d, dist.cells<uint8_t>(), goals, num_goals);
+    break;
+  case 2:
+    dijkstra_tunnel_cells(d, dist.cells<uint16_t>(), goals, num_goals);
+    break;
+  default:
+    dijkstra_tunnel_cells(d, dist.cells<uint32_t>(), goals, num_goals);
+    break;
+  }
+}
+
+void dijkstra_tunnel(dungeon *d)
+{
+  dijkstra_tunnel_goals(d, d->pc_tunnel, &d->PC->position, 1);
+}
+
+static void repair_push(repair_queue_t *q, uint32_t i)
+{
+  if (!q->queued[i]) {
+    q->queued[i] = 1;
+    q->cell[(q->head + q->size++) % q->cell.size()] = i;
+  }
+}
+
+static uint32_t repair_pop(repair_queue_t *q)
+{
+  uint32_t i;
+
+  i = q->cell[q->head];
+  q->head = (q->head + 1) % q->cell.size();
+  q->size--;
+  q->queued[i] = 0;
+
+  return i;
+}
+
+template <class T>
+static void repair_distance(dungeon *d, grid<T> &dist, repair_queue_t *q,
+                            pair_t *cells, uint32_t num_cells)
+{
+  const T infinity = (T) -1;
+  int32_t offset[8];
+  uint32_t c, i, k, n, num;
+  uint32_t improved[8];
+  T best;
+
+  neighbor_offsets(d, offset);
+
+  /* Newly opened floor takes the best distance of its floor neighbors. */
+  for (n = 0; n < num_cells; n++) {
+    c = cells[n][dim_y] * d->width + cells[n][dim_x];
+    if (d->map.data()[c] < ter_floor) {
+      continue;
+    }
+    if (cells[n][dim_x] == d->PC->position[dim_x] &&
+        cells[n][dim_y] == d->PC->position[dim_y]) {
+      best = 0;
+    } else {
+      for (best = infinity, k = 0; k < 8; k++) {
+        i = c + offset[k];
+        if ((d->map.data()[i] >= ter_floor)  &&
+            (dist.data()[i] < infinity - 1)  &&
+            (dist.data()[i] + 1 < best)) {
+          best = dist.data()[i] + 1;
+        }
+      }
+    }
+    if (best < dist.data()[c]) {
+      dist.data()[c] = best;
+      repair_push(q, c);
+    }
+  }
+
+  while (q->size) {
+    num = relax(dist.data(), d->map.data(), repair_pop(q), offset,
+                walk_terrain, 1, improved);
+    for (k = 0; k < num; k++) {
+      repair_push(q, improved[k]);
+    }
+  }
+}
+
+template <class T>
+static void repair_tunnel(dungeon *d, grid<T> &dist, repair_queue_t *q,
+                          pair_t *cells, uint32_t num_cells)
+{
+  int32_t offset[8];
+  uint32_t c, k, n, num;
+  uint32_t improved[8];
+
+  neighbor_offsets(d, offset);
+
+  /* A tunneling move costs the hardness of the cell it leaves, so a *
+   * changed cell keeps its own distance but may shorten paths       *
+   * through it to each of its neighbors.                            */
+  for (n = 0; n < num_cells; n++) {
+    repair_push(q, cells[n][dim_y] * d->width + cells[n][dim_x]);
+  }
+
+  while (q->size) {
+    c = repair_pop(q);
+    if (d->map.data()[c] == ter_wall_immutable) {
+      continue;
+    }
+    num = relax(dist.data(), d->map.data(), c, offset,
+                tunnel_terrain, tunnel_cell_cost(c), improved);
+    for (k = 0; k < num; k++) {
+      repair_push(q, improved[k]);
+    }
+  }
+}
+
+void dijkstra_repair(dungeon *d, pair_t *cells, uint32_t num_cells)
+{
+  /* Tunneling only ever opens walls and softens rock, so distances can *
+   * only go down.  Starting from the changed cells, push improvements  *
+   * outward until nothing else improves; cells that can't be reached   *
+   * by a shorter path through the changed ones are never touched.  The *
+   * order of relaxation doesn't matter for correctness, since a cell   *
+   * that improves again is simply queued again.                        */
+
+  repair_queue_t &q = d->path_repair_queue;
+
+  /* The queue is empty between calls, so it can be resized freely. */
+  if (q.cell.size() != d->map.size()) {
+    q.cell.assign(d->map.size(), 0);
+    q.queued.assign(d->map.size(), 0);
+    q.head = 0;
+  }
+
+  switch (d->pc_distance.bytes()) {
+  case 1:
+    repair_distance(d, d->pc_distance.cells<uint8_t>(), &q, cells, num_cells);
+    break;
+  case 2:
+    repair_distance(d, d->pc_distance.cells<uint16_t>(), &q, cells, num_cells);
+    break;
+  default:
+    repair_distance(d, d->pc_distance.cells<uint32_t>(), &q, cells, num_cells);
+    break;
+  }
+
+  switch (d->pc_tunnel.bytes()) {
+  case 1:
+    repair_tunnel(d, d->pc_tunnel.cells<uint8_t>(), &q, cells, num_cells);
+    break;
+  case 2:
+    repair_tunnel(d, d->pc_tunnel.cells<uint16_t>(), &q, cells, num_cells);
+    break;
+  default:
+    repair_tunnel(d, d->pc_tunnel.cells<uint32_t>(), &q, cells, num_cells);
+    break;
+  }
+}
+
+static uint32_t path_is_current(dungeon *d)
+{
+  return (d->path_pc_generation == d->pc_generation &&
+          d->path_terrain_generation == d->terrain_generation);
+}
+
+static uint64_t path_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void path_pc_moved(dungeon *d)
+{
+  d->pc_generation++;
+  d->path_requests++;
+}
+
+void path_terrain_changed(dungeon *d, pair_t *cells, uint32_t num_cells)
+{
+  /* If the maps are current, a local change can be repaired in place *
+   * and they stay current.  If they are already stale, the rebuild   *
+   * will see the new terrain anyway.  The same goes for the bit      *
+   * layers over the map.                                             */
+  uint64_t start;
+  uint32_t layers_current;
+
+  layers_current = d->layers_terrain_generation == d->terrain_generation;
+  if (num_cells && path_is_current(d)) {
+    start = path_clock();
+    dijkstra_repair(d, cells, num_cells);
+    d->path_nsec += path_clock() - start;
+    d->path_repairs++;
+    d->terrain_generation++;
+    d->path_terrain_generation = d->terrain_generation;
+  } else {
+    d->terrain_generation++;
+  }
+  if (num_cells && layers_current) {
+    terrain_layers_set(d, cells, num_cells);
+    d->layers_terrain_generation = d->terrain_generation;
+  }
+  d->path_requests++;
+}
+
+/* Makes the cache hold as many pairs of maps as fit in path_cache_kb. *
+ * resize_dungeon() empties it, so its maps are always the right size. */
+static void path_cache_size(dungeon *d)
+{
+  path_cache_entry_t e;
+  uint32_t bytes;
+
+  bytes = (d->pc_distance.size() * d->pc_distance.bytes() +
+           d->pc_tunnel.size() * d->pc_tunnel.bytes());
+  if (d->path_cache.size() != d->path_cache_kb * 1024ULL / bytes) {
+    e.pc[dim_x] = e.pc[dim_y] = 0;
+    e.terrain_generation = 0;
+    e.last_used = 0;
+    e.distance = d->pc_distance;
+    e.tunnel = d->pc_tunnel;
+    d->path_cache.assign(d->path_cache_kb * 1024ULL / bytes, e);
+  }
+}
+
+/* Swaps the maps the PC needs now out of the cache, if it has them, *
+ * and returns whether it did.  Either way, the outgoing maps take   *
+ * the place of the cache's best or least recently used entry, so    *
+ * nothing is ever copied.  Only entries for the current terrain can *
+ * hit, so any others are the first to go.                           */
+static uint32_t path_cache_swap(dungeon *d)
+{
+  path_cache_entry_t *e, *hit, *victim;
+  uint32_t i;
+
+  path_cache_size(d);
+  if (d->path_cache.empty()) {
+    return 0;
+  }
+
+  for (hit = victim = NULL, i = 0; i < d->path_cache.size(); i++) {
+    e = &d->path_cache[i];
+    if (e->terrain_generation != d->terrain_generation) {
+      e->last_used = 0;
+    } else if (e->pc[dim_x] == d->PC->position[dim_x] &&
+               e->pc[dim_y] == d->PC->position[dim_y]) {
+      hit = e;
+    }
+    if (!victim || e->last_used < victim->last_used) {
+      victim = e;
+    }
+  }
+  e = hit ? hit : victim;
+
+  d->pc_distance.swap(e->distance);
+  d->pc_tunnel.swap(e->tunnel);
+
+  /* A PC is never on the outer wall, so maps for (0, 0) are no maps. */
+  e->pc[dim_x] = d->path_pc_position[dim_x];
+  e->pc[dim_y] = d->path_pc_position[dim_y];
+  e->terrain_generation = d->path_terrain_generation;
+  e->last_used = ++d->path_cache_tick;
+
+  if (hit) {
+    d->path_cache_hits++;
+  } else {
+    d->path_cache_misses++;
+  }
+
+  return hit != NULL;
+}
+
+void path_update(dungeon *d)
+{
+  uint64_t start;
+
+  /* Maps that are current for a PC position the PC comes back to are *
+   * just as current the second time, as long as the terrain hasn't   *
+   * changed in between, so rather than throw them away, the last few *
+   * pairs are kept in a cache (path_cache_swap()).                   */
+  if (!path_is_current(d)) {
+    start = path_clock();
+    if (!path_cache_swap(d)) {
+      dijkstra(d);
+      dijkstra_tunnel(d);
+      d->path_recomputes++;
+    }
+    d->path_nsec += path_clock() - start;
+    d->path_pc_position[dim_x] = d->PC->position[dim_x];
+    d->path_pc_position[dim_y] = d->PC->position[dim_y];
+    d->path_pc_generation = d->pc_generation;
+    d->path_terrain_generation = d->terrain_generation;
+  }
+}
+
+#ifdef BENCHMARK
+
+/* Times dijkstra() and dijkstra_tunnel() against the Fibonacci heap     *
+ * implementations they replaced on each dungeon named on the command    *
+ * line, and verifies that both produce identical maps.  The heap        *
+ * versions only know the one-byte maps of default-sized dungeons, so    *
+ * bigger ones are skipped.  ns/cell is the time per cell expanded,      *
+ * which is mostly the cost of one relax().  Build with:                 *
+ *   make && g++ -O2 -DBENCHMARK -DTERM='"S2021"' -c path.cpp -o bench.o *
+ *   g++ bench.o $(ls *.o | grep -v -e rlg327.o -e path.o) -lncurses     */
+
+# include <cstdio>
+# include <cstring>
+# include <ctime>
+
 /* Ugly hack: There is no way to pass a pointer to the dungeon into the *
  * heap's comparitor funtion without modifying the heap.  Copying the   *
  * pc_distance array is a possible solution, but that doubles the       *
@@ -15,57 +517,64 @@
  * is ugly.                                                             */
 static dungeon *thedungeon;
 
+/* Both reference searches put at most one node per cell into the heap, *
+ * and they never run concurrently, so they share a single node pool.   */
+static heap_pool_t *path_pool(void)
+{
+  static heap_pool_t *pool;
+
+  if (!pool) {
+    pool = heap_pool_new(DUNGEON_X * DUNGEON_Y);
+  }
+
+  return pool;
+}
+
 typedef struct path {
   heap_node_t *hn;
-  uint8_t pos[2];
+  pair_t pos;
 } path_t;
 
 static int32_t dist_cmp(const void *key, const void *with) {
-  return ((int32_t) thedungeon->pc_distance[((path_t *) key)->pos[dim_y]]
-                                           [((path_t *) key)->pos[dim_x]] -
-          (int32_t) thedungeon->pc_distance[((path_t *) with)->pos[dim_y]]
-                                           [((path_t *) with)->pos[dim_x]]);
+  return ((int32_t) thedungeon->pc_distance.get(((path_t *) key)->pos[dim_y],
+                                                ((path_t *) key)->pos[dim_x]) -
+          (int32_t) thedungeon->pc_distance.get(((path_t *) with)->pos[dim_y],
+                                                ((path_t *) with)->pos[dim_x]));
 }
 
 static int32_t tunnel_cmp(const void *key, const void *with) {
-  return ((int32_t) thedungeon->pc_tunnel[((path_t *) key)->pos[dim_y]]
-                                         [((path_t *) key)->pos[dim_x]] -
-          (int32_t) thedungeon->pc_tunnel[((path_t *) with)->pos[dim_y]]
-                                         [((path_t *) with)->pos[dim_x]]);
+  return ((int32_t) thedungeon->pc_tunnel.get(((path_t *) key)->pos[dim_y],
+                                              ((path_t *) key)->pos[dim_x]) -
+          (int32_t) thedungeon->pc_tunnel.get(((path_t *) with)->pos[dim_y],
+                                              ((path_t *) with)->pos[dim_x]));
 }
 
-void dijkstra(dungeon *d)
+static void dijkstra_heap(dungeon *d)
 {
-  /* Currently assumes that monsters only move on floors.  Will *
-   * need to be modified for tunneling and pass-wall monsters.  */
-
+  grid<uint8_t> &dist = d->pc_distance.cells<uint8_t>();
   heap_t h;
   uint32_t x, y;
-  static path_t p[DUNGEON_Y][DUNGEON_X], *c;
-  static uint32_t initialized = 0;
+  static grid<path_t> p;
+  path_t *c;
 
-  if (!initialized) {
-    initialized = 1;
+  if (p.width() != d->width || p.height() != d->height) {
     thedungeon = d;
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
+    p.resize(d->width, d->height);
+    for (y = 0; y < d->height; y++) {
+      for (x = 0; x < d->width; x++) {
         p[y][x].pos[dim_y] = y;
         p[y][x].pos[dim_x] = x;
       }
     }
   }
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      d->pc_distance[y][x] = 255;
-    }
-  }
-  d->pc_distance[d->PC->position[dim_y]][d->PC->position[dim_x]] = 0;
+  dist.fill(255);
+  dist[d->PC->position[dim_y]][d->PC->position[dim_x]] = 0;
 
-  heap_init(&h, dist_cmp, NULL);
+  heap_init_pooled(&h, dist_cmp, NULL, path_pool());
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
       if (mapxy(x, y) >= ter_floor) {
         p[y][x].hn = heap_insert(&h, &p[y][x]);
       }
@@ -75,66 +584,66 @@ void dijkstra(dungeon *d)
   while ((c = (path_t *) heap_remove_min(&h))) {
     c->hn = NULL;
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn) &&
-        (d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x] - 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
+        (dist[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
+      dist[c->pos[dim_y] - 1][c->pos[dim_x] - 1] =
+        dist[c->pos[dim_y]][c->pos[dim_x]] + 1;
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn);
     }
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x]    ].hn) &&
-        (d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x]    ] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x]    ] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
+        (dist[c->pos[dim_y] - 1][c->pos[dim_x]    ] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
+      dist[c->pos[dim_y] - 1][c->pos[dim_x]    ] =
+        dist[c->pos[dim_y]][c->pos[dim_x]] + 1;
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] - 1][c->pos[dim_x]    ].hn);
     }
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x] + 1].hn) &&
-        (d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x] + 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x] + 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
+        (dist[c->pos[dim_y] - 1][c->pos[dim_x] + 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
+      dist[c->pos[dim_y] - 1][c->pos[dim_x] + 1] =
+        dist[c->pos[dim_y]][c->pos[dim_x]] + 1;
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] - 1][c->pos[dim_x] + 1].hn);
     }
     if ((p[c->pos[dim_y]    ][c->pos[dim_x] - 1].hn) &&
-        (d->pc_distance[c->pos[dim_y]    ][c->pos[dim_x] - 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y]    ][c->pos[dim_x] - 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
+        (dist[c->pos[dim_y]    ][c->pos[dim_x] - 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
+      dist[c->pos[dim_y]    ][c->pos[dim_x] - 1] =
+        dist[c->pos[dim_y]][c->pos[dim_x]] + 1;
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y]    ][c->pos[dim_x] - 1].hn);
     }
     if ((p[c->pos[dim_y]    ][c->pos[dim_x] + 1].hn) &&
-        (d->pc_distance[c->pos[dim_y]    ][c->pos[dim_x] + 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y]    ][c->pos[dim_x] + 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
+        (dist[c->pos[dim_y]    ][c->pos[dim_x] + 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
+      dist[c->pos[dim_y]    ][c->pos[dim_x] + 1] =
+        dist[c->pos[dim_y]][c->pos[dim_x]] + 1;
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y]    ][c->pos[dim_x] + 1].hn);
     }
     if ((p[c->pos[dim_y] + 1][c->pos[dim_x] - 1].hn) &&
-        (d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x] - 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x] - 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
+        (dist[c->pos[dim_y] + 1][c->pos[dim_x] - 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
+      dist[c->pos[dim_y] + 1][c->pos[dim_x] - 1] =
+        dist[c->pos[dim_y]][c->pos[dim_x]] + 1;
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] + 1][c->pos[dim_x] - 1].hn);
     }
     if ((p[c->pos[dim_y] + 1][c->pos[dim_x]    ].hn) &&
-        (d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x]    ] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x]    ] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
+        (dist[c->pos[dim_y] + 1][c->pos[dim_x]    ] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
+      dist[c->pos[dim_y] + 1][c->pos[dim_x]    ] =
+        dist[c->pos[dim_y]][c->pos[dim_x]] + 1;
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] + 1][c->pos[dim_x]    ].hn);
     }
     if ((p[c->pos[dim_y] + 1][c->pos[dim_x] + 1].hn) &&
-        (d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x] + 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x] + 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
+        (dist[c->pos[dim_y] + 1][c->pos[dim_x] + 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
+      dist[c->pos[dim_y] + 1][c->pos[dim_x] + 1] =
+        dist[c->pos[dim_y]][c->pos[dim_x]] + 1;
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] + 1][c->pos[dim_x] + 1].hn);
     }
@@ -142,44 +651,33 @@ void dijkstra(dungeon *d)
   heap_delete(&h);
 }
 
-/* Ignores the case of hardness == 255, because if *
- * that gets here, there's already been an error.  */
-#define tunnel_movement_cost(x, y)                      \
-  ((d->hardness[y][x] / 85) + 1)
-
-void dijkstra_tunnel(dungeon *d)
+static void dijkstra_tunnel_heap(dungeon *d)
 {
-  /* Currently assumes that monsters only move on floors.  Will *
-   * need to be modified for tunneling and pass-wall monsters.  */
-
+  grid<uint8_t> &dist = d->pc_tunnel.cells<uint8_t>();
   heap_t h;
   uint32_t x, y;
   uint32_t size;
-  static path_t p[DUNGEON_Y][DUNGEON_X], *c;
-  static uint32_t initialized = 0;
+  static grid<path_t> p;
+  path_t *c;
 
-  if (!initialized) {
-    initialized = 1;
+  if (p.width() != d->width || p.height() != d->height) {
     thedungeon = d;
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
+    p.resize(d->width, d->height);
+    for (y = 0; y < d->height; y++) {
+      for (x = 0; x < d->width; x++) {
         p[y][x].pos[dim_y] = y;
         p[y][x].pos[dim_x] = x;
       }
     }
   }
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      d->pc_tunnel[y][x] = 255;
-    }
-  }
-  d->pc_tunnel[d->PC->position[dim_y]][d->PC->position[dim_x]] = 0;
+  dist.fill(255);
+  dist[d->PC->position[dim_y]][d->PC->position[dim_x]] = 0;
 
-  heap_init(&h, tunnel_cmp, NULL);
+  heap_init_pooled(&h, tunnel_cmp, NULL, path_pool());
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
       if (mapxy(x, y) != ter_wall_immutable) {
         p[y][x].hn = heap_insert(&h, &p[y][x]);
       }
@@ -193,81 +691,81 @@ void dijkstra_tunnel(dungeon *d)
     }
     c->hn = NULL;
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+        (dist[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x] - 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+      dist[c->pos[dim_y] - 1][c->pos[dim_x] - 1] =
+        (dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn);
     }
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x]    ].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x]    ] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+        (dist[c->pos[dim_y] - 1][c->pos[dim_x]    ] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x]    ] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+      dist[c->pos[dim_y] - 1][c->pos[dim_x]    ] =
+        (dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] - 1][c->pos[dim_x]    ].hn);
     }
     if ((p[c->pos[dim_y] - 1][c->pos[dim_x] + 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x] + 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+        (dist[c->pos[dim_y] - 1][c->pos[dim_x] + 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x] + 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+      dist[c->pos[dim_y] - 1][c->pos[dim_x] + 1] =
+        (dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] - 1][c->pos[dim_x] + 1].hn);
     }
     if ((p[c->pos[dim_y]    ][c->pos[dim_x] - 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y]    ][c->pos[dim_x] - 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+        (dist[c->pos[dim_y]    ][c->pos[dim_x] - 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y]    ][c->pos[dim_x] - 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+      dist[c->pos[dim_y]    ][c->pos[dim_x] - 1] =
+        (dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y]    ][c->pos[dim_x] - 1].hn);
     }
     if ((p[c->pos[dim_y]    ][c->pos[dim_x] + 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y]    ][c->pos[dim_x] + 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+        (dist[c->pos[dim_y]    ][c->pos[dim_x] + 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y]    ][c->pos[dim_x] + 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+      dist[c->pos[dim_y]    ][c->pos[dim_x] + 1] =
+        (dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y]    ][c->pos[dim_x] + 1].hn);
     }
     if ((p[c->pos[dim_y] + 1][c->pos[dim_x] - 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x] - 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+        (dist[c->pos[dim_y] + 1][c->pos[dim_x] - 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x] - 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+      dist[c->pos[dim_y] + 1][c->pos[dim_x] - 1] =
+        (dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] + 1][c->pos[dim_x] - 1].hn);
     }
     if ((p[c->pos[dim_y] + 1][c->pos[dim_x]    ].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x]    ] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+        (dist[c->pos[dim_y] + 1][c->pos[dim_x]    ] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x]    ] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+      dist[c->pos[dim_y] + 1][c->pos[dim_x]    ] =
+        (dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] + 1][c->pos[dim_x]    ].hn);
     }
     if ((p[c->pos[dim_y] + 1][c->pos[dim_x] + 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x] + 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+        (dist[c->pos[dim_y] + 1][c->pos[dim_x] + 1] >
+         dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x] + 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
+      dist[c->pos[dim_y] + 1][c->pos[dim_x] + 1] =
+        (dist[c->pos[dim_y]][c->pos[dim_x]] +
          tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
       heap_decrease_key_no_replace(&h,
                                    p[c->pos[dim_y] + 1][c->pos[dim_x] + 1].hn);
@@ -275,3 +773,192 @@ void dijkstra_tunnel(dungeon *d)
   }
   heap_delete(&h);
 }
+
+static double bench_seconds(void (*f)(dungeon *), dungeon *d, uint32_t n)
+{
+  struct timespec start, end;
+  uint32_t i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < n; i++) {
+    f(d);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  return ((end.tv_sec - start.tv_sec) +
+          (end.tv_nsec - start.tv_nsec) / 1000000000.0);
+}
+
+typedef distance_map dungeon::*distance_map_t;
+
+/* The number of cells a search expanded, which is every cell it *
+ * found a distance for.  Each of them is one call to relax().   */
+static uint32_t bench_reached(dungeon *d, const distance_map &m)
+{
+  uint32_t x, y, n;
+
+  for (n = y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
+      n += m.get(y, x) != m.infinity();
+    }
+  }
+
+  return n;
+}
+
+static const struct {
+  const char *name;
+  void (*reference)(dungeon *d);
+  void (*engine)(dungeon *d);
+  distance_map_t map;
+} bench_engines[] = {
+  { "distance", dijkstra_heap,        dijkstra,        &dungeon::pc_distance },
+  { "tunnel",   dijkstra_tunnel_heap, dijkstra_tunnel, &dungeon::pc_tunnel   },
+};
+
+# define num_bench_engines (sizeof (bench_engines) / sizeof (bench_engines[0]))
+
+int main(int argc, char *argv[])
+{
+  dungeon d;
+  distance_map reference;
+  double heap_time, engine_time;
+  double heap_total[num_bench_engines], engine_total[num_bench_engines];
+  uint64_t reached_total[num_bench_engines];
+  uint32_t n, e, reached;
+  int i;
+
+  n = 1000;
+
+  init_dungeon(&d);
+  d.PC = new pc;
+
+  printf("%-32s %-8s %10s %10s %8s %8s\n",
+         "dungeon", "map", "heap us", "new us", "speedup", "ns/cell");
+  for (e = 0; e < num_bench_engines; e++) {
+    heap_total[e] = engine_total[e] = 0;
+    reached_total[e] = 0;
+  }
+  for (i = 1; i < argc; i++) {
+    free(d.rooms);
+    d.PC->position[dim_x] = d.PC->position[dim_y] = 0;
+    read_dungeon(&d, argv[i]);
+    if (d.pc_distance.bytes() != 1 || d.pc_tunnel.bytes() != 1) {
+      fprintf(stderr, "%s: skipped, not the default size\n", argv[i]);
+      continue;
+    }
+
+    for (e = 0; e < num_bench_engines; e++) {
+      bench_engines[e].reference(&d);
+      reference = d.*bench_engines[e].map;
+      bench_engines[e].engine(&d);
+      if (reference != d.*bench_engines[e].map) {
+        fprintf(stderr, "%s: %s maps differ!\n", argv[i],
+                bench_engines[e].name);
+        return 1;
+      }
+      reached = bench_reached(&d, d.*bench_engines[e].map);
+
+      heap_time = bench_seconds(bench_engines[e].reference, &d, n);
+      engine_time = bench_seconds(bench_engines[e].engine, &d, n);
+      heap_total[e] += heap_time;
+      engine_total[e] += engine_time;
+      reached_total[e] += reached;
+      printf("%-32s %-8s %10.2f %10.2f %7.2fx %8.2f\n",
+             argv[i], bench_engines[e].name,
+             heap_time * 1000000 / n, engine_time * 1000000 / n,
+             heap_time / engine_time,
+             engine_time * 1000000000 / n / reached);
+    }
+  }
+  for (e = 0; e < num_bench_engines; e++) {
+    printf("%-32s %-8s %10.2f %10.2f %7.2fx %8.2f\n",
+           "total", bench_engines[e].name,
+           heap_total[e] * 1000000 / n, engine_total[e] * 1000000 / n,
+           heap_total[e] / engine_total[e],
+           engine_total[e] * 1000000000 / n / reached_total[e]);
+  }
+
+  return 0;
+}
+
+#endif
+
+#ifdef TESTING
+
+/* Property test for dijkstra_repair(): on randomly generated dungeons, *
+ * repeatedly open or soften random rock the way tunneling monsters do, *
+ * repair the maps, and check them against a full recompute.  Build     *
+ * the same way as the benchmark, with -DTESTING instead.  An optional  *
+ * second argument, <width>x<height>, tests a bigger dungeon.           */
+
+# include <cstdio>
+
+int main(int argc, char *argv[])
+{
+  dungeon dun, *d;
+  distance_map distance, tunnel;
+  pair_t cells[4];
+  uint32_t seed, seeds, step, n, num_cells, checks;
+  uint16_t width, height;
+
+  seeds = argc > 1 ? atoi(argv[1]) : 100;
+
+  d = &dun;
+  if (argc > 2 && sscanf(argv[2], "%hux%hu", &width, &height) == 2) {
+    resize_dungeon(d, width, height);
+  }
+  init_dungeon(d);
+  d->PC = new pc;
+
+  for (checks = seed = 0; seed < seeds; seed++) {
+    seed_dungeon(d, seed);
+    free(d->rooms);
+    gen_dungeon(d);
+    n = d->map_rng.range(0, d->num_rooms - 1);
+    d->PC->position[dim_x] = d->map_rng.range(d->rooms[n].position[dim_x],
+                                              (d->rooms[n].position[dim_x] +
+                                               d->rooms[n].size[dim_x] - 1));
+    d->PC->position[dim_y] = d->map_rng.range(d->rooms[n].position[dim_y],
+                                              (d->rooms[n].position[dim_y] +
+                                               d->rooms[n].size[dim_y] - 1));
+    dijkstra(d);
+    dijkstra_tunnel(d);
+
+    for (step = 0; step < 200; step++) {
+      num_cells = d->map_rng.range(1, 4);
+      for (n = 0; n < num_cells; n++) {
+        do {
+          cells[n][dim_x] = d->map_rng.range(1, d->width - 2);
+          cells[n][dim_y] = d->map_rng.range(1, d->height - 2);
+        } while (mappair(cells[n]) >= ter_floor);
+        if (hardnesspair(cells[n]) <= 85) {
+          hardnesspair(cells[n]) = 0;
+          mappair(cells[n]) = ter_floor_hall;
+        } else {
+          hardnesspair(cells[n]) -= 85;
+        }
+      }
+
+      dijkstra_repair(d, cells, num_cells);
+      distance = d->pc_distance;
+      tunnel = d->pc_tunnel;
+      dijkstra(d);
+      dijkstra_tunnel(d);
+      checks++;
+
+      if (distance != d->pc_distance || tunnel != d->pc_tunnel) {
+        fprintf(stderr, "Seed %u, step %u: repaired %s map differs from "
+                "full recompute.\n", seed, step,
+                distance != d->pc_distance ? "distance" : "tunnel");
+        return 1;
+      }
+    }
+  }
+
+  printf("%u repairs matched a full recompute.\n", checks);
+
+  return 0;
+}
+
+#endif
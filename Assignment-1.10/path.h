@@ -1,11 +1,72 @@
 #ifndef PATH_H
 # define PATH_H
 
+# include <stdint.h>
+# include <vector>
+
+# include "dims.h"
+# include "distance.h"
+
 # define HARDNESS_PER_TURN 85
 
+/* The largest cost of a tunneling move. */
+# define TUNNEL_MAX_COST 4
+
+/* The default size of the flow-field cache, in kilobytes. */
+# define PATH_CACHE_KB 64
+
 class dungeon;
 
+/* A distance map to some set of goals, with the game time and terrain *
+ * generation it was built at, for callers that rebuild it lazily.     *
+ * goals has room for goals_size of them, and only ever grows; it's    *
+ * freed by delete_dungeon().                                          */
+typedef struct goal_map {
+  distance_map dist;
+  uint32_t time;
+  uint32_t terrain_generation;
+  pair_t *goals;
+  uint32_t goals_size;
+} goal_map_t;
+
+/* A pair of distance maps in the flow-field cache, with the PC position *
+ * and terrain generation they were built for.  See path_update().       */
+typedef struct path_cache_entry {
+  pair_t pc;
+  uint32_t terrain_generation;
+  uint32_t last_used;
+  distance_map distance;
+  distance_map tunnel;
+} path_cache_entry_t;
+
+/* A FIFO of linearized cell indices for dijkstra_repair().  Unlike the *
+ * BFS frontier, cells can re-enter after leaving, so this one wraps;   *
+ * the queued flags keep any cell from being in it twice at once.       */
+typedef struct repair_queue {
+  std::vector<uint32_t> cell;
+  std::vector<uint8_t> queued;
+  uint32_t head, size;
+} repair_queue_t;
+
 void dijkstra(dungeon *d);
 void dijkstra_tunnel(dungeon *d);
+/* Distance maps to the nearest of any number of goal cells, built in *
+ * one search, for monsters that are after something other than the   *
+ * PC.  dist must already be the size of the dungeon; dijkstra() and  *
+ * dijkstra_tunnel() are these with the PC as the only goal.          */
+void dijkstra_goals(dungeon *d, distance_map &dist,
+                    pair_t *goals, uint32_t num_goals);
+void dijkstra_tunnel_goals(dungeon *d, distance_map &dist,
+                           pair_t *goals, uint32_t num_goals);
+/* Updates both distance maps after the terrain or hardness of the given *
+ * cells has gone down, e.g., when a tunneler breaks or softens a wall.  */
+void dijkstra_repair(dungeon *d, pair_t *cells, uint32_t num_cells);
+
+/* Lazy maintenance of the distance maps.  Writers report changes; readers  *
+ * call path_update() before looking at pc_distance or pc_tunnel.  Passing  *
+ * no cells to path_terrain_changed() means the whole map may have changed. */
+void path_pc_moved(dungeon *d);
+void path_terrain_changed(dungeon *d, pair_t *cells, uint32_t num_cells);
+void path_update(dungeon *d);
 
 #endif
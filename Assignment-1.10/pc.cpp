@@ -69,14 +69,15 @@ uint32_t pc_is_alive(dungeon *d)
 
 void place_pc(dungeon *d)
 {
-  d->PC->position[dim_y] = rand_range(d->rooms->position[dim_y],
-                                     (d->rooms->position[dim_y] +
-                                      d->rooms->size[dim_y] - 1));
-  d->PC->position[dim_x] = rand_range(d->rooms->position[dim_x],
-                                     (d->rooms->position[dim_x] +
-                                      d->rooms->size[dim_x] - 1));
-
-  pc_init_known_terrain(d->PC);
+  d->PC->position[dim_y] = d->map_rng.range(d->rooms->position[dim_y],
+                                           (d->rooms->position[dim_y] +
+                                            d->rooms->size[dim_y] - 1));
+  d->PC->position[dim_x] = d->map_rng.range(d->rooms->position[dim_x],
+                                           (d->rooms->position[dim_x] +
+                                            d->rooms->size[dim_x] - 1));
+  path_pc_moved(d);
+
+  pc_init_known_terrain(d->PC, d);
   pc_observe_terrain(d->PC, d);
 
   io_display(d);
@@ -101,15 +102,18 @@ void config_pc(dungeon *d)
   d->PC->name = "Isabella Garcia-Shapiro";
 
   d->character_map[d->PC->position[dim_y]][d->PC->position[dim_x]] = d->PC;
-
-  dijkstra(d);
-  dijkstra_tunnel(d);
 }
 
+/* The autopilot rolls its own dice, d->autopilot_rng, not the other   *
+ * streams, so that the game depends only on the keys the PC presses.  *
+ * That's what makes a game recorded from pc_next_pos() replayable     *
+ * without it.  Its stream and its memory are the dungeon's, so each   *
+ * game of a --headless batch plays just as it would alone.            */
 uint32_t pc_next_pos(dungeon *d, pair_t dir)
 {
-  static uint32_t have_seen_corner = 0;
-  static uint32_t count = 0;
+  uint32_t &have_seen_corner = d->autopilot_seen_corner;
+  uint32_t &count = d->autopilot_corner_turns;
+  rng &autopilot_rng = d->autopilot_rng;
 
   dir[dim_y] = dir[dim_x] = 0;
 
@@ -146,20 +150,22 @@ uint32_t pc_next_pos(dungeon *d, pair_t dir)
     if (count) {
       count++;
     }
-    if (!against_wall(d, d->PC) && ((rand() & 0x111) == 0x111)) {
-      dir[dim_x] = (rand() % 3) - 1;
-      dir[dim_y] = (rand() % 3) - 1;
+    if (!against_wall(d, d->PC) &&
+        ((autopilot_rng.next() & 0x111) == 0x111)) {
+      dir[dim_x] = autopilot_rng.range(-1, 1);
+      dir[dim_y] = autopilot_rng.range(-1, 1);
     } else {
       dir_nearest_wall(d, d->PC, dir);
     }
   }else {
     /* And after we've been there, let's head toward the center of the map. */
-    if (!against_wall(d, d->PC) && ((rand() & 0x111) == 0x111)) {
-      dir[dim_x] = (rand() % 3) - 1;
-      dir[dim_y] = (rand() % 3) - 1;
+    if (!against_wall(d, d->PC) &&
+        ((autopilot_rng.next() & 0x111) == 0x111)) {
+      dir[dim_x] = autopilot_rng.range(-1, 1);
+      dir[dim_y] = autopilot_rng.range(-1, 1);
     } else {
-      dir[dim_x] = ((d->PC->position[dim_x] > DUNGEON_X / 2) ? -1 : 1);
-      dir[dim_y] = ((d->PC->position[dim_y] > DUNGEON_Y / 2) ? -1 : 1);
+      dir[dim_x] = ((d->PC->position[dim_x] > d->width / 2) ? -1 : 1);
+      dir[dim_y] = ((d->PC->position[dim_y] > d->height / 2) ? -1 : 1);
     }
   }
 
@@ -222,81 +228,134 @@ uint32_t pc_in_room(dungeon *d, uint32_t room)
 void pc_learn_terrain(pc *p, pair_t pos, terrain_type ter)
 {
   p->known_terrain[pos[dim_y]][pos[dim_x]] = ter;
-  p->visible[pos[dim_y]][pos[dim_x]] = 1;
+  p->visible.set(pos[dim_y], pos[dim_x], 1);
 }
 
 void pc_reset_visibility(pc *p)
 {
-  uint32_t y, x;
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      p->visible[y][x] = 0;
-    }
-  }
+  p->visible.fill(0);
 }
 
 terrain_type pc_learned_terrain(pc *p, int16_t y, int16_t x)
 {
-  if (y < 0 || y >= DUNGEON_Y || x < 0 || x >= DUNGEON_X) {
+  if (y < 0 || y >= p->known_terrain.height() ||
+      x < 0 || x >= p->known_terrain.width()) {
     io_queue_message("Invalid value to %s: %d, %d", __FUNCTION__, y, x);
   }
 
   return p->known_terrain[y][x];
 }
 
-void pc_init_known_terrain(pc *p)
+void pc_init_known_terrain(pc *p, dungeon *d)
 {
-  uint32_t y, x;
+  p->known_terrain.resize(d->width, d->height, ter_unknown);
+  p->visible.resize(d->width, d->height);
+}
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      p->known_terrain[y][x] = ter_unknown;
-      p->visible[y][x] = 0;
+/* Recursive shadowcasting.  The square around the PC is cut into      *
+ * eight octants, and each is scanned a row at a time outward from the *
+ * PC, keeping the range of slopes that is still lit.  A run of walls  *
+ * in a row narrows that range for the rows beyond it (and starts a    *
+ * recursive scan of the part before the run).  Every cell in range is *
+ * looked at once, and rows that are entirely in shadow aren't looked  *
+ * at at all.                                                          *
+ *                                                                     *
+ * An octant's cells are (col, -row) for col in [-row, 0], mapped onto *
+ * the map by the transform below.  Neighboring octants share the      *
+ * cells on the axis or diagonal between them; the order here makes    *
+ * the even octants own both of their edges, so the odd ones skip them *
+ * and nothing is learned twice.                                       *
+ *                                                                     *
+ * This lights more than the can_see() rays it replaced, mostly walls  *
+ * beside lit floor that a ray stopped short of, so the PC sees, and   *
+ * remembers, more of the map than it used to.                         */
+typedef struct octant {
+  int8_t xx, xy, yx, yy;
+} octant_t;
+
+static const octant_t octants[8] = {
+  {  1,  0,  0,  1 },
+  {  0,  1,  1,  0 },
+  {  0,  1, -1,  0 },
+  {  1,  0,  0, -1 },
+  { -1,  0,  0, -1 },
+  {  0, -1, -1,  0 },
+  {  0, -1,  1,  0 },
+  { -1,  0,  0,  1 }
+};
+
+static void shadowcast(pc *p, dungeon *d, uint32_t o, int32_t row,
+                       double start, double end, int32_t radius)
+{
+  const octant_t *t = octants + o;
+  int32_t col;
+  pair_t cell;
+  double left, right, next_start;
+  uint32_t blocked, opaque;
+
+  for (blocked = 0; !blocked && row <= radius; row++) {
+    next_start = start;
+    for (col = -row; col <= 0; col++) {
+      left = (col - 0.5) / (-row + 0.5);
+      right = (col + 0.5) / (-row - 0.5);
+      if (start < right) {
+        continue;
+      } else if (end > left) {
+        break;
+      }
+
+      cell[dim_x] = p->position[dim_x] + col * t->xx - row * t->xy;
+      cell[dim_y] = p->position[dim_y] + col * t->yx - row * t->yy;
+      if (cell[dim_x] < 0 || cell[dim_x] >= d->width ||
+          cell[dim_y] < 0 || cell[dim_y] >= d->height) {
+        opaque = 1;
+      } else {
+        if (!(o & 1) || (col && col != -row)) {
+          pc_learn_terrain(p, cell, mappair(cell));
+          pc_see_object(p, objpair(cell));
+        }
+        opaque = !walkablepair(cell);
+      }
+
+      if (blocked) {
+        if (opaque) {
+          next_start = right;
+        } else {
+          blocked = 0;
+          start = next_start;
+        }
+      } else if (opaque && row < radius) {
+        blocked = 1;
+        shadowcast(p, d, o, row + 1, start, left, radius);
+        next_start = right;
+      }
     }
   }
 }
 
-void pc_observe_terrain(pc *p, dungeon *d)
+/* Learns everything the PC can see within radius cells (in the same *
+ * square metric as movement), marking it visible.                   */
+void pc_observe_terrain_within(pc *p, dungeon *d, int32_t radius)
 {
-  pair_t where;
-  int16_t y_min, y_max, x_min, x_max;
+  uint32_t o;
 
-  y_min = p->position[dim_y] - PC_VISUAL_RANGE;
-  if (y_min < 0) {
-    y_min = 0;
-  }
-  y_max = p->position[dim_y] + PC_VISUAL_RANGE;
-  if (y_max > DUNGEON_Y - 1) {
-    y_max = DUNGEON_Y - 1;
-  }
-  x_min = p->position[dim_x] - PC_VISUAL_RANGE;
-  if (x_min < 0) {
-    x_min = 0;
-  }
-  x_max = p->position[dim_x] + PC_VISUAL_RANGE;
-  if (x_max > DUNGEON_X - 1) {
-    x_max = DUNGEON_X - 1;
-  }
+  terrain_layers_update(d);
 
-  for (where[dim_y] = y_min; where[dim_y] <= y_max; where[dim_y]++) {
-    where[dim_x] = x_min;
-    can_see(d, p->position, where, 1, 1);
-    where[dim_x] = x_max;
-    can_see(d, p->position, where, 1, 1);
+  pc_learn_terrain(p, p->position, mappair(p->position));
+  pc_see_object(p, objpair(p->position));
+  for (o = 0; o < 8; o++) {
+    shadowcast(p, d, o, 1, 1.0, 0.0, radius);
   }
-  /* Take one off the x range because we alreay hit the corners above. */
-  for (where[dim_x] = x_min - 1; where[dim_x] <= x_max - 1; where[dim_x]++) {
-    where[dim_y] = y_min;
-    can_see(d, p->position, where, 1, 1);
-    where[dim_y] = y_max;
-    can_see(d, p->position, where, 1, 1);
-  }       
+}
+
+void pc_observe_terrain(pc *p, dungeon *d)
+{
+  pc_observe_terrain_within(p, d, PC_VISUAL_RANGE);
 }
 
 int32_t is_illuminated(pc *p, int16_t y, int16_t x)
 {
-  return p->visible[y][x];
+  return p->visible.get(y, x);
 }
 
 void pc_see_object(character *the_pc, object *o)
@@ -486,3 +545,164 @@ object *pc::from_pile(dungeon *d, pair_t pos)
 
   return o;
 }
+
+#ifdef BENCHMARK
+
+/* Times pc_observe_terrain_within() against the ray casting it        *
+ * replaced, from every open cell of each dungeon named on the command *
+ * line and at a few radii, and compares what each of them lights: on  *
+ * average, how many cells per call, and how many of those only one of *
+ * them lit.  The rays use can_see() at the monsters' range, so the    *
+ * radius can't go past NPC_VISUAL_RANGE.  Build with:                 *
+ *   make && g++ -O2 -DBENCHMARK -DTERM='"S2021"' -c pc.cpp -o b.o     *
+ *   g++ b.o $(ls *.o | grep -v -e rlg327.o -e ^pc.o) -lncurses        */
+
+# include <cstdio>
+# include <ctime>
+
+static void pc_observe_terrain_rays(pc *p, dungeon *d, int32_t radius)
+{
+  pair_t where;
+  int16_t y_min, y_max, x_min, x_max;
+
+  y_min = p->position[dim_y] - radius;
+  if (y_min < 0) {
+    y_min = 0;
+  }
+  y_max = p->position[dim_y] + radius;
+  if (y_max > d->height - 1) {
+    y_max = d->height - 1;
+  }
+  x_min = p->position[dim_x] - radius;
+  if (x_min < 0) {
+    x_min = 0;
+  }
+  x_max = p->position[dim_x] + radius;
+  if (x_max > d->width - 1) {
+    x_max = d->width - 1;
+  }
+
+  for (where[dim_y] = y_min; where[dim_y] <= y_max; where[dim_y]++) {
+    where[dim_x] = x_min;
+    can_see(d, p->position, where, 0, 1);
+    where[dim_x] = x_max;
+    can_see(d, p->position, where, 0, 1);
+  }
+  for (where[dim_x] = x_min - 1; where[dim_x] <= x_max - 1; where[dim_x]++) {
+    where[dim_y] = y_min;
+    can_see(d, p->position, where, 0, 1);
+    where[dim_y] = y_max;
+    can_see(d, p->position, where, 0, 1);
+  }
+}
+
+static uint32_t bench_lit(const bitmap &b)
+{
+  uint32_t i, n;
+
+  for (n = i = 0; i < b.size(); i++) {
+    n += __builtin_popcountll(b.row(0)[i]);
+  }
+
+  return n;
+}
+
+/* Every cell lit by exactly one of a and b. */
+static uint32_t bench_differ(const bitmap &a, const bitmap &b)
+{
+  uint32_t i, n;
+
+  for (n = i = 0; i < a.size(); i++) {
+    n += __builtin_popcountll(a.row(0)[i] ^ b.row(0)[i]);
+  }
+
+  return n;
+}
+
+typedef void (*observe_t)(pc *p, dungeon *d, int32_t radius);
+
+/* Observes from every open cell and returns the time taken.  lit and *
+ * visible add up what was lit, and what was lit from each cell.      */
+static double bench_observe(dungeon *d, observe_t f, int32_t radius,
+                            uint64_t *lit, bitmap *visible)
+{
+  struct timespec start, end;
+  double seconds;
+  uint32_t x, y, i;
+
+  seconds = 0;
+  for (i = y = 0; y < d->height; y++) {
+    for (x = 0; x < d->width; x++) {
+      if (!walkablexy(x, y)) {
+        continue;
+      }
+      d->PC->position[dim_x] = x;
+      d->PC->position[dim_y] = y;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      pc_reset_visibility(d->PC);
+      f(d->PC, d, radius);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      seconds += ((end.tv_sec - start.tv_sec) +
+                  (end.tv_nsec - start.tv_nsec) / 1000000000.0);
+      *lit += bench_lit(d->PC->visible);
+      visible[i++] = d->PC->visible;
+    }
+  }
+
+  return seconds;
+}
+
+int main(int argc, char *argv[])
+{
+  static const int32_t radii[] = { PC_VISUAL_RANGE, 8, NPC_VISUAL_RANGE };
+  dungeon d;
+  bitmap *rays, *shadow;
+  double ray_time, shadow_time;
+  uint64_t ray_lit, shadow_lit, differ;
+  uint32_t calls, x, y, i, r;
+  int a;
+
+  init_dungeon(&d);
+  d.PC = new pc;
+
+  printf("%-28s %6s %9s %9s %8s %8s %8s %8s\n", "dungeon", "radius",
+         "rays us", "shadow us", "speedup", "ray lit", "shd lit", "differ");
+  for (a = 1; a < argc; a++) {
+    free(d.rooms);
+    d.PC->position[dim_x] = d.PC->position[dim_y] = 0;
+    read_dungeon(&d, argv[a]);
+    pc_init_known_terrain(d.PC, &d);
+    terrain_layers_rebuild(&d);
+
+    for (calls = y = 0; y < d.height; y++) {
+      for (x = 0; x < d.width; x++) {
+        calls += d.walkable.get(y, x);
+      }
+    }
+    rays = new bitmap[calls];
+    shadow = new bitmap[calls];
+
+    for (r = 0; r < sizeof (radii) / sizeof (radii[0]); r++) {
+      ray_lit = shadow_lit = differ = 0;
+      ray_time = bench_observe(&d, pc_observe_terrain_rays, radii[r],
+                               &ray_lit, rays);
+      shadow_time = bench_observe(&d, pc_observe_terrain_within, radii[r],
+                                  &shadow_lit, shadow);
+      for (i = 0; i < calls; i++) {
+        differ += bench_differ(rays[i], shadow[i]);
+      }
+      printf("%-28s %6d %9.2f %9.2f %7.2fx %8.1f %8.1f %8.1f\n",
+             argv[a], radii[r],
+             ray_time * 1000000 / calls, shadow_time * 1000000 / calls,
+             ray_time / shadow_time, (double) ray_lit / calls,
+             (double) shadow_lit / calls, (double) differ / calls);
+    }
+
+    delete [] rays;
+    delete [] shadow;
+  }
+
+  return 0;
+}
+
+#endif
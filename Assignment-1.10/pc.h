@@ -41,8 +41,8 @@ class pc : public character {
   uint32_t drop_in(dungeon *d, uint32_t slot);
   uint32_t destroy_in(uint32_t slot);
   uint32_t pick_up(dungeon *d);
-  terrain_type known_terrain[DUNGEON_Y][DUNGEON_X];
-  uint8_t visible[DUNGEON_Y][DUNGEON_X];
+  grid<terrain_type> known_terrain;
+  bitmap visible;
   uint32_t has_open_inventory_slot();
   int32_t get_first_open_inventory_slot();
 };
@@ -55,8 +55,9 @@ void place_pc(dungeon *d);
 uint32_t pc_in_room(dungeon *d, uint32_t room);
 void pc_learn_terrain(pc *p, pair_t pos, terrain_type ter);
 terrain_type pc_learned_terrain(pc *p, int16_t y, int16_t x);
-void pc_init_known_terrain(pc *p);
+void pc_init_known_terrain(pc *p, dungeon *d);
 void pc_observe_terrain(pc *p, dungeon *d);
+void pc_observe_terrain_within(pc *p, dungeon *d, int32_t radius);
 int32_t is_illuminated(pc *p, int16_t y, int16_t x);
 void pc_reset_visibility(pc *p);
 
@@ -0,0 +1,89 @@
+#include <cstdlib>
+#include <algorithm>
+
+#include "registry.h"
+#include "character.h"
+
+void monster_registry::resize(uint16_t width, uint16_t height)
+{
+  blocks_wide = (width + REGISTRY_BLOCK - 1) >> REGISTRY_SHIFT;
+  blocks_high = (height + REGISTRY_BLOCK - 1) >> REGISTRY_SHIFT;
+  blocks.resize(blocks_wide * blocks_high);
+  clear();
+}
+
+void monster_registry::clear()
+{
+  uint32_t i;
+
+  all.clear();
+  for (i = 0; i < blocks.size(); i++) {
+    blocks[i].clear();
+  }
+}
+
+void monster_registry::add(character *c)
+{
+  all.push_back(c);
+  block(c->position[dim_y], c->position[dim_x]).push_back(c);
+}
+
+/* Order doesn't matter in either list, so the last entry fills the hole. */
+static void remove_from(std::vector<character *> &v, character *c)
+{
+  std::vector<character *>::iterator i;
+
+  if ((i = std::find(v.begin(), v.end(), c)) != v.end()) {
+    *i = v.back();
+    v.pop_back();
+  }
+}
+
+void monster_registry::remove(character *c)
+{
+  remove_from(all, c);
+  remove_from(block(c->position[dim_y], c->position[dim_x]), c);
+}
+
+void monster_registry::moved(character *c, pair_t from)
+{
+  std::vector<character *> &old_block = block(from[dim_y], from[dim_x]);
+  std::vector<character *> &new_block = block(c->position[dim_y],
+                                              c->position[dim_x]);
+
+  if (&old_block != &new_block) {
+    remove_from(old_block, c);
+    new_block.push_back(c);
+  }
+}
+
+uint32_t monster_registry::near(pair_t p, int16_t radius,
+                                std::vector<character *> &found) const
+{
+  int32_t bx, by, bx_min, bx_max, by_min, by_max;
+  uint32_t i, n;
+  character *c;
+
+  by_min = std::max(p[dim_y] - radius, 0) >> REGISTRY_SHIFT;
+  by_max = std::min(p[dim_y] + radius,
+                    (blocks_high << REGISTRY_SHIFT) - 1) >> REGISTRY_SHIFT;
+  bx_min = std::max(p[dim_x] - radius, 0) >> REGISTRY_SHIFT;
+  bx_max = std::min(p[dim_x] + radius,
+                    (blocks_wide << REGISTRY_SHIFT) - 1) >> REGISTRY_SHIFT;
+
+  for (n = 0, by = by_min; by <= by_max; by++) {
+    for (bx = bx_min; bx <= bx_max; bx++) {
+      const std::vector<character *> &b = blocks[by * blocks_wide + bx];
+      for (i = 0; i < b.size(); i++) {
+        c = b[i];
+        if (abs(c->position[dim_y] - p[dim_y]) <= radius &&
+            abs(c->position[dim_x] - p[dim_x]) <= radius) {
+          found.push_back(c);
+          n++;
+        }
+      }
+    }
+  }
+
+  return n;
+}
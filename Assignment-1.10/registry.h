@@ -0,0 +1,60 @@
+#ifndef REGISTRY_H
+# define REGISTRY_H
+
+# include <stdint.h>
+# include <vector>
+
+# include "dims.h"
+
+class character;
+
+/* Every live monster, kept two ways: in one dense list, for going over  *
+ * all of them without touching the map, and in a coarse spatial hash of *
+ * REGISTRY_BLOCK x REGISTRY_BLOCK squares of cells, for finding the     *
+ * ones near a point by looking in a few squares.  character_map is      *
+ * still the authority on who is where; whatever moves, places or kills  *
+ * a monster tells the registry as well (see move_character() and        *
+ * do_combat()).  The PC isn't in it.                                    */
+
+# define REGISTRY_SHIFT 3
+# define REGISTRY_BLOCK (1 << REGISTRY_SHIFT)
+
+class monster_registry {
+ private:
+  std::vector<character *> all;
+  std::vector<std::vector<character *> > blocks;
+  uint16_t blocks_wide, blocks_high;
+  std::vector<character *> &block(int16_t y, int16_t x)
+  {
+    return blocks[(y >> REGISTRY_SHIFT) * blocks_wide +
+                  (x >> REGISTRY_SHIFT)];
+  }
+ public:
+  monster_registry() : all(), blocks(), blocks_wide(0), blocks_high(0) {}
+  monster_registry(uint16_t width, uint16_t height) :
+    all(), blocks(), blocks_wide(0), blocks_high(0)
+  {
+    resize(width, height);
+  }
+  /* Empties the registry, too. */
+  void resize(uint16_t width, uint16_t height);
+  void clear();
+  void add(character *c);
+  void remove(character *c);
+  /* c has already been moved from from to c->position. */
+  void moved(character *c, pair_t from);
+  inline uint32_t size() const
+  {
+    return all.size();
+  }
+  inline character *operator[](uint32_t i) const
+  {
+    return all[i];
+  }
+  /* Appends every monster within radius cells of p (in the square *
+   * metric) to found, and returns how many there were.            */
+  uint32_t near(pair_t p, int16_t radius,
+                std::vector<character *> &found) const;
+};
+
+#endif
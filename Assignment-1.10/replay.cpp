@@ -0,0 +1,200 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <endian.h>
+
+#include "replay.h"
+#include "utils.h"
+#include "dungeon.h"
+
+/* A replay file is the header below followed by one record for every *
+ * key the game read, to end of file.  All multi-byte fields are big  *
+ * endian, like the dungeon save files.                               *
+ *                                                                    *
+ *   semantic      sizeof (REPLAY_SEMANTIC) - 1 bytes                 *
+ *   version       4 bytes                                            *
+ *   seed          4 bytes                                            *
+ *   max_monsters  2 bytes                                            *
+ *   max_objects   2 bytes                                            *
+ *   max_turns     4 bytes                                            *
+ *   width         2 bytes, version 1 and later                       *
+ *   height        2 bytes, version 1 and later                       *
+ *   do_load       1 byte                                             *
+ *   do_image      1 byte                                             *
+ *   parallel_ai   1 byte, version 2 and later                        *
+ *   file length   2 bytes, zero if there is no file name             *
+ *   file name     file length bytes, no NULL terminator              *
+ *                                                                    *
+ * Each record is 6 bytes: the PC turn the key was read on (4 bytes)  *
+ * and the key itself (2 bytes, enough for the ncurses KEY_ codes).   *
+ * The turn is redundant when the game is deterministic, which is     *
+ * exactly why it's there: a replay that stops matching its turns     *
+ * has diverged, and we'd rather say so than play some other game.    */
+
+static FILE *replay_file;
+static uint32_t replay_writing;
+static char *replay_dungeon_file;
+
+void replay_record(const char *file, replay_header_t *h)
+{
+  uint32_t be32;
+  uint16_t be16, len;
+
+  if (!(replay_file = fopen(file, "w"))) {
+    perror(file);
+    exit(-1);
+  }
+  replay_writing = 1;
+
+  fwrite(REPLAY_SEMANTIC, 1, sizeof (REPLAY_SEMANTIC) - 1, replay_file);
+  be32 = htobe32(REPLAY_VERSION);
+  fwrite(&be32, sizeof (be32), 1, replay_file);
+  be32 = htobe32(h->seed);
+  fwrite(&be32, sizeof (be32), 1, replay_file);
+  be16 = htobe16(h->max_monsters);
+  fwrite(&be16, sizeof (be16), 1, replay_file);
+  be16 = htobe16(h->max_objects);
+  fwrite(&be16, sizeof (be16), 1, replay_file);
+  be32 = htobe32(h->max_turns);
+  fwrite(&be32, sizeof (be32), 1, replay_file);
+  be16 = htobe16(h->width);
+  fwrite(&be16, sizeof (be16), 1, replay_file);
+  be16 = htobe16(h->height);
+  fwrite(&be16, sizeof (be16), 1, replay_file);
+  fwrite(&h->do_load, 1, 1, replay_file);
+  fwrite(&h->do_image, 1, 1, replay_file);
+  fwrite(&h->parallel_ai, 1, 1, replay_file);
+  len = h->file ? strlen(h->file) : 0;
+  be16 = htobe16(len);
+  fwrite(&be16, sizeof (be16), 1, replay_file);
+  fwrite(h->file, 1, len, replay_file);
+}
+
+static void replay_fread(void *p, size_t size)
+{
+  if (fread(p, size, 1, replay_file) != 1) {
+    fprintf(stderr, "Replay file is truncated.\n");
+    exit(-1);
+  }
+}
+
+void replay_open(const char *file, replay_header_t *h)
+{
+  char semantic[sizeof (REPLAY_SEMANTIC)];
+  uint32_t be32, version;
+  uint16_t be16, len;
+
+  if (!(replay_file = fopen(file, "r"))) {
+    perror(file);
+    exit(-1);
+  }
+  replay_writing = 0;
+
+  replay_fread(semantic, sizeof (REPLAY_SEMANTIC) - 1);
+  if (strncmp(semantic, REPLAY_SEMANTIC, sizeof (REPLAY_SEMANTIC) - 1)) {
+    fprintf(stderr, "Not an RLG327 replay file.\n");
+    exit(-1);
+  }
+  replay_fread(&be32, sizeof (be32));
+  if ((version = be32toh(be32)) > REPLAY_VERSION) {
+    fprintf(stderr, "Replay version mismatch.\n");
+    exit(-1);
+  }
+  replay_fread(&be32, sizeof (be32));
+  h->seed = be32toh(be32);
+  replay_fread(&be16, sizeof (be16));
+  h->max_monsters = be16toh(be16);
+  replay_fread(&be16, sizeof (be16));
+  h->max_objects = be16toh(be16);
+  replay_fread(&be32, sizeof (be32));
+  h->max_turns = be32toh(be32);
+  h->width = DUNGEON_X;
+  h->height = DUNGEON_Y;
+  if (version >= 1) {
+    replay_fread(&be16, sizeof (be16));
+    h->width = be16toh(be16);
+    replay_fread(&be16, sizeof (be16));
+    h->height = be16toh(be16);
+  }
+  replay_fread(&h->do_load, 1);
+  replay_fread(&h->do_image, 1);
+  h->parallel_ai = 0;
+  if (version >= 2) {
+    replay_fread(&h->parallel_ai, 1);
+  }
+  replay_fread(&be16, sizeof (be16));
+  h->file = NULL;
+  if ((len = be16toh(be16))) {
+    replay_dungeon_file = (char *) malloc(len + 1);
+    replay_fread(replay_dungeon_file, len);
+    replay_dungeon_file[len] = '\0';
+    h->file = replay_dungeon_file;
+  }
+}
+
+/* Frees the file name handed out by replay_open(). */
+void replay_close(void)
+{
+  if (replay_file) {
+    fclose(replay_file);
+    replay_file = NULL;
+  }
+  if (replay_dungeon_file) {
+    free(replay_dungeon_file);
+    replay_dungeon_file = NULL;
+  }
+}
+
+uint32_t replay_is_recording(void)
+{
+  return replay_file && replay_writing;
+}
+
+uint32_t replay_is_replaying(void)
+{
+  return replay_file && !replay_writing;
+}
+
+uint32_t replay_at_end(void)
+{
+  int c;
+
+  if ((c = fgetc(replay_file)) == EOF) {
+    return 1;
+  }
+  ungetc(c, replay_file);
+
+  return 0;
+}
+
+void replay_write_key(uint32_t turn, int32_t key)
+{
+  uint32_t be32;
+  uint16_t be16;
+
+  be32 = htobe32(turn);
+  fwrite(&be32, sizeof (be32), 1, replay_file);
+  be16 = htobe16((uint16_t) key);
+  fwrite(&be16, sizeof (be16), 1, replay_file);
+}
+
+/* Returns the next recorded key, or escape once the log runs out, which *
+ * backs out of any menu the game happens to be in.                      */
+int32_t replay_read_key(uint32_t turn)
+{
+  uint32_t be32;
+  uint16_t be16;
+
+  if (fread(&be32, sizeof (be32), 1, replay_file) != 1 ||
+      fread(&be16, sizeof (be16), 1, replay_file) != 1) {
+    return 27 /* ESC */;
+  }
+  if (be32toh(be32) != turn) {
+    fprintf(stderr, "Replay diverged: key recorded on turn %u read on "
+            "turn %u.\n", be32toh(be32), turn);
+    exit(-1);
+  }
+
+  return (int16_t) be16toh(be16);
+}
@@ -0,0 +1,39 @@
+#ifndef REPLAY_H
+# define REPLAY_H
+
+# include <stdint.h>
+
+# define REPLAY_SEMANTIC "RLG327-REPLAY-" TERM
+# define REPLAY_VERSION  2U
+
+/* Everything main() needs to recreate a game: the seed and the *
+ * switches that change what the seed produces.  file is the    *
+ * dungeon or PGM file when do_load or do_image is set, or NULL *
+ * for the default save file.  width and height are the size of *
+ * a generated dungeon; version 0 replays are always the        *
+ * default size.                                                */
+typedef struct replay_header {
+  uint32_t seed;
+  uint16_t max_monsters;
+  uint16_t max_objects;
+  uint32_t max_turns;
+  uint16_t width;
+  uint16_t height;
+  uint8_t do_load;
+  uint8_t do_image;
+  /* Monsters planned their moves in parallel (--ai-threads); how *
+   * many threads did it doesn't matter.  Version 2 and later.    */
+  uint8_t parallel_ai;
+  char *file;
+} replay_header_t;
+
+void replay_record(const char *file, replay_header_t *h);
+void replay_open(const char *file, replay_header_t *h);
+void replay_close(void);
+uint32_t replay_is_recording(void);
+uint32_t replay_is_replaying(void);
+uint32_t replay_at_end(void);
+void replay_write_key(uint32_t turn, int32_t key);
+int32_t replay_read_key(uint32_t turn);
+
+#endif
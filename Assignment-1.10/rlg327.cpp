@@ -3,6 +3,7 @@
 #include <sys/time.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "dungeon.h"
 #include "pc.h"
@@ -11,6 +12,7 @@
 #include "utils.h"
 #include "io.h"
 #include "object.h"
+#include "replay.h"
 
 const char *victory =
   "\n                                       o\n"
@@ -69,12 +71,311 @@ void usage(char *name)
   fprintf(stderr,
           "Usage: %s [-r|--rand <seed>] [-l|--load [<file>]]\n"
           "          [-s|--save [<file>]] [-i|--image <pgm file>]\n"
-          "          [-n|--nummon <count>] [-o|--objcount <oject count>]\n",
+          "          [-n|--nummon <count>] [-o|--objcount <oject count>]\n"
+          "          [-h|--headless [<games>]] [-t|--turns <count>]\n"
+          "          [--record <replay file>] [--replay <replay file>]\n"
+          "          [-g|--generate <count>] [-j|--jobs <threads>]\n"
+          "          [-d|--dimensions <width>x<height>]\n"
+          "          [-c|--cache <kilobytes>] [-a|--ai-threads <threads>]\n"
+          "          [--check]\n",
           name);
 
   exit(-1);
 }
 
+static double seconds_since(struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+
+  return ((now.tv_sec - start->tv_sec) +
+          (now.tv_usec - start->tv_usec) / 1000000.0);
+}
+
+/* Plays one headless game from seed, in a dungeon of its own, and   *
+ * returns the dungeon as the game left it, for the caller to read   *
+ * and then pass to end_headless_game().  turns gets the PC turns    *
+ * played, elapsed the time it took, and steady_allocations the      *
+ * events allocated other than on the turns a level began or ended.  */
+static dungeon *play_headless_game(dungeon *template_d, uint32_t seed,
+                                   uint32_t max_turns, char *load_file,
+                                   char *pgm_file, uint32_t do_load,
+                                   uint32_t do_image, uint32_t *turns,
+                                   double *elapsed,
+                                   uint64_t *steady_allocations)
+{
+  dungeon *d;
+  uint32_t before, level_turn;
+  struct timeval start;
+
+  /* A fresh dungeon--and fresh descriptions--each game, otherwise *
+   * uniques killed in one game could never appear in the next.    */
+  d = new dungeon;
+  d->max_monsters = template_d->max_monsters;
+  d->max_objects = template_d->max_objects;
+  d->path_cache_kb = template_d->path_cache_kb;
+  d->ai_threads = template_d->ai_threads;
+  resize_dungeon(d, template_d->width, template_d->height);
+
+  seed_dungeon(d, seed);
+  parse_descriptions(d);
+  init_dungeon(d);
+  if (do_load) {
+    read_dungeon(d, load_file);
+  } else if (do_image) {
+    read_pgm(d, pgm_file);
+  } else {
+    gen_dungeon(d);
+  }
+  config_pc(d);
+  gen_monsters(d);
+  gen_objects(d);
+  pc_observe_terrain(d->PC, d);
+
+  *steady_allocations = 0;
+  gettimeofday(&start, NULL);
+  for (*turns = 0;
+       pc_is_alive(d) && boss_is_alive(d) && !d->quit &&
+         (!max_turns || *turns < max_turns);
+       (*turns)++) {
+    /* A new level fills a new event pool; other than on the turns   *
+     * that arrive on or leave a level, nothing should be allocated. */
+    level_turn = d->is_new;
+    before = d->event_allocations;
+    do_moves(d);
+    if (!level_turn && !d->is_new) {
+      *steady_allocations += d->event_allocations - before;
+    }
+  }
+  *elapsed = seconds_since(&start);
+
+  return d;
+}
+
+static void end_headless_game(dungeon *d)
+{
+  if (pc_is_alive(d)) {
+    character_delete(d->PC);
+  }
+  delete_dungeon(d);
+  destroy_descriptions(d);
+  delete d;
+}
+
+/* Plays games with nothing drawn and pc_next_pos() at the keyboard, *
+ * game n seeded with seed + n, and reports how fast the simulation  *
+ * ran.  Only the game loop is timed; parsing the descriptions and   *
+ * building the dungeon are not.  A limit of zero turns means the    *
+ * game runs until somebody wins.                                    *
+ *                                                                   *
+ * Game n is meant to play exactly as it would alone, with seed + n, *
+ * so a batch is a repeatable workload and any game of it can be     *
+ * looked at by itself.  Anything one game leaves behind for the     *
+ * next breaks that.  With check set, the last game of a batch is    *
+ * first played alone, untimed, before any other, and its turn in    *
+ * the batch has to come out the same.                               */
+static void play_headless(dungeon *template_d, uint32_t seed, uint32_t games,
+                          uint32_t max_turns, char *load_file,
+                          char *pgm_file, uint32_t do_load, uint32_t do_image,
+                          uint32_t check)
+{
+  dungeon *d;
+  uint32_t g, turns, won, lost;
+  uint64_t total_turns, total_events, total_batches, path_nsec;
+  uint64_t requests, recomputes, repairs, hits, misses;
+  uint64_t los_queries, los_walks;
+  uint64_t allocations, steady_allocations, planned, replanned, steady;
+  uint32_t last_turns, last_time, last_events, last_alive;
+  double elapsed, game_elapsed;
+
+  io_init_headless();
+
+  won = lost = 0;
+  total_turns = total_events = total_batches = path_nsec = 0;
+  requests = recomputes = repairs = hits = misses = 0;
+  los_queries = los_walks = 0;
+  allocations = steady_allocations = planned = replanned = 0;
+  last_turns = last_time = last_events = last_alive = 0;
+  elapsed = 0.0;
+
+  if (check && games > 1) {
+    d = play_headless_game(template_d, seed + games - 1, max_turns,
+                           load_file, pgm_file, do_load, do_image,
+                           &last_turns, &game_elapsed, &steady);
+    last_time = d->time;
+    last_events = d->num_events;
+    last_alive = pc_is_alive(d);
+    end_headless_game(d);
+  }
+
+  for (g = 0; g < games; g++) {
+    d = play_headless_game(template_d, seed + g, max_turns, load_file,
+                           pgm_file, do_load, do_image, &turns,
+                           &game_elapsed, &steady);
+    elapsed += game_elapsed;
+    steady_allocations += steady;
+
+    if (!pc_is_alive(d)) {
+      lost++;
+    } else if (!boss_is_alive(d)) {
+      won++;
+    }
+    total_turns += turns;
+    total_events += d->num_events;
+    total_batches += d->num_batches;
+    path_nsec += d->path_nsec;
+    requests += d->path_requests;
+    recomputes += d->path_recomputes;
+    repairs += d->path_repairs;
+    hits += d->path_cache_hits;
+    misses += d->path_cache_misses;
+    los_queries += d->los_queries;
+    los_walks += d->los_walks;
+    allocations += d->event_allocations;
+    planned += d->planned_moves;
+    replanned += d->replanned_moves;
+
+    if (check && g && g == games - 1 &&
+        (turns != last_turns || d->time != last_time ||
+         d->num_events != last_events || pc_is_alive(d) != last_alive)) {
+      io_reset_terminal();
+      fprintf(stderr, "Game %u of the batch didn't play as it does alone "
+              "with seed %u.\n", g, seed + g);
+      exit(-1);
+    }
+
+    end_headless_game(d);
+  }
+
+  io_reset_terminal();
+
+  if (elapsed == 0.0) {
+    elapsed = 1e-9;
+  }
+  printf("%u games from seed %u: %u won, %u lost, %u stopped\n",
+         games, seed, won, lost, games - won - lost);
+  printf("%12lu turns    %14.0f turns/sec\n",
+         total_turns, total_turns / elapsed);
+  printf("%12lu events   %14.0f events/sec\n",
+         total_events, total_events / elapsed);
+  printf("%12lu batches   %13.1f events each\n", total_batches,
+         total_batches ? (double) total_events / total_batches : 0.0);
+  printf("%12.3f seconds in the game loop\n", elapsed);
+  printf("%12.3f seconds pathfinding (%.1f%%)\n",
+         path_nsec / 1e9, 100.0 * (path_nsec / 1e9) / elapsed);
+  printf("%12lu distance map requests, %lu rebuilt, %lu repaired\n",
+         requests, recomputes, repairs);
+  printf("%12lu flow-field cache hits, %lu misses\n", hits, misses);
+  printf("%12lu line-of-sight checks, %lu rays walked, %.1f saved per turn\n",
+         los_queries, los_walks,
+         total_turns ? (double) (los_queries - los_walks) / total_turns : 0.0);
+  printf("%12lu event allocations, %lu in steady-state turns\n",
+         allocations, steady_allocations);
+  if (template_d->ai_threads) {
+    printf("%12lu moves planned on %u threads, %lu planned again\n",
+           planned, template_d->ai_threads, replanned);
+  }
+}
+
+typedef struct generate_job {
+  uint32_t seed;
+  uint32_t count;
+  uint32_t first;
+  uint32_t stride;
+  uint16_t width;
+  uint16_t height;
+} generate_job_t;
+
+/* Generates and saves dungeons first, first + stride, ... < count, *
+ * dungeon i from seed + i, to <seed + i>.rlg327.  Each dungeon is  *
+ * independent--its own random streams, no shared state--so any     *
+ * number of these can run at once and the files come out the same  *
+ * regardless.                                                      */
+static void *generate_worker(void *v)
+{
+  generate_job_t *job = (generate_job_t *) v;
+  dungeon *d;
+  /* 10 bytes for number, plus dot, extention and null terminator. */
+  char file[18];
+  uint32_t i;
+
+  for (i = job->first; i < job->count; i += job->stride) {
+    d = new dungeon;
+    resize_dungeon(d, job->width, job->height);
+    seed_dungeon(d, job->seed + i);
+    init_dungeon(d);
+    gen_dungeon(d);
+
+    /* The save format has a PC position.  place_pc() would also set up *
+     * the distance maps and draw the screen, which we don't want here. */
+    d->PC = new pc;
+    d->PC->position[dim_y] = d->map_rng.range(d->rooms->position[dim_y],
+                                              (d->rooms->position[dim_y] +
+                                               d->rooms->size[dim_y] - 1));
+    d->PC->position[dim_x] = d->map_rng.range(d->rooms->position[dim_x],
+                                              (d->rooms->position[dim_x] +
+                                               d->rooms->size[dim_x] - 1));
+
+    sprintf(file, "%u.rlg327", job->seed + i);
+    write_dungeon(d, file);
+
+    delete d->PC;
+    delete_dungeon(d);
+    delete d;
+  }
+
+  return NULL;
+}
+
+/* Writes count dungeons to the working directory with 1, 2, 4, ... *
+ * threads, and finally jobs threads, and reports how generation    *
+ * scales.  Every run writes the same files.                        */
+static void generate_dungeons(uint32_t seed, uint32_t count, uint32_t jobs,
+                              uint16_t width, uint16_t height)
+{
+  pthread_t *threads;
+  generate_job_t *job;
+  struct timeval start;
+  double elapsed, base;
+  uint32_t n, t;
+
+  threads = (pthread_t *) malloc(jobs * sizeof (*threads));
+  job = (generate_job_t *) malloc(jobs * sizeof (*job));
+
+  printf("%u dungeons from seed %u\n", count, seed);
+  printf("threads  dungeons/sec  speedup\n");
+  for (base = 0.0, n = 1; ; n = (2 * n < jobs) ? 2 * n : jobs) {
+    gettimeofday(&start, NULL);
+    for (t = 0; t < n; t++) {
+      job[t].seed = seed;
+      job[t].count = count;
+      job[t].first = t;
+      job[t].stride = n;
+      job[t].width = width;
+      job[t].height = height;
+      if (pthread_create(threads + t, NULL, generate_worker, job + t)) {
+        perror("pthread_create");
+        exit(-1);
+      }
+    }
+    for (t = 0; t < n; t++) {
+      pthread_join(threads[t], NULL);
+    }
+    elapsed = seconds_since(&start);
+    if (!base) {
+      base = elapsed;
+    }
+    printf("%7u  %12.0f  %6.2fx\n", n, count / elapsed, base / elapsed);
+    if (n == jobs) {
+      break;
+    }
+  }
+
+  free(threads);
+  free(job);
+}
+
 int main(int argc, char *argv[])
 {
   dungeon d;
@@ -82,18 +383,29 @@ int main(int argc, char *argv[])
   struct timeval tv;
   int32_t i;
   uint32_t do_load, do_save, do_seed, do_image, do_save_seed, do_save_image;
+  uint32_t do_headless, games, max_turns, check;
+  uint32_t generate, jobs;
   uint32_t long_arg;
+  uint16_t width, height;
   char *save_file;
   char *load_file;
   char *pgm_file;
+  char *record_file;
+  char *replay_file;
+  replay_header_t header;
   
   /* Default behavior: Seed with the time, generate a new dungeon, *
    * and don't write to disk.                                      */
   do_load = do_save = do_image = do_save_seed = do_save_image = 0;
   do_seed = 1;
-  save_file = load_file = NULL;
+  do_headless = max_turns = generate = check = 0;
+  jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  games = 1;
+  save_file = load_file = pgm_file = record_file = replay_file = NULL;
   d.max_monsters = MAX_MONSTERS;
   d.max_objects = MAX_OBJECTS;
+  width = DUNGEON_X;
+  height = DUNGEON_Y;
 
   /* The project spec requires '--load' and '--save'.  It's common  *
    * to have short and long forms of most switches (assuming you    *
@@ -126,13 +438,26 @@ int main(int argc, char *argv[])
           }
           break;
         case 'r':
-          if ((!long_arg && argv[i][2]) ||
-              (long_arg && strcmp(argv[i], "-rand")) ||
-              argc < ++i + 1 /* No more arguments */ ||
-              !sscanf(argv[i], "%lu", &seed) /* Argument is not an integer */) {
-            usage(argv[0]);
+          /* Out of letters: '--record' and '--replay' are long only. */
+          if (long_arg && !strcmp(argv[i], "-record")) {
+            if (argc < ++i + 1 /* No more arguments */) {
+              usage(argv[0]);
+            }
+            record_file = argv[i];
+          } else if (long_arg && !strcmp(argv[i], "-replay")) {
+            if (argc < ++i + 1 /* No more arguments */) {
+              usage(argv[0]);
+            }
+            replay_file = argv[i];
+          } else {
+            if ((!long_arg && argv[i][2]) ||
+                (long_arg && strcmp(argv[i], "-rand")) ||
+                argc < ++i + 1 /* No more arguments */ ||
+                !sscanf(argv[i], "%lu", &seed) /* Argument is not an integer */) {
+              usage(argv[0]);
+            }
+            do_seed = 0;
           }
-          do_seed = 0;
           break;
         case 'l':
           if ((!long_arg && argv[i][2]) ||
@@ -188,6 +513,77 @@ int main(int argc, char *argv[])
             usage(argv[0]);
           }
           break;
+        case 'h':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-headless"))) {
+            usage(argv[0]);
+          }
+          do_headless = 1;
+          if ((argc > i + 1) && argv[i + 1][0] != '-') {
+            /* There is another argument, and it's not a switch, so *
+             * it's the number of games to play.                    */
+            if (!sscanf(argv[++i], "%u", &games) || !games) {
+              usage(argv[0]);
+            }
+          }
+          break;
+        case 't':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-turns")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &max_turns)) {
+            usage(argv[0]);
+          }
+          break;
+        case 'g':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-generate")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &generate) || !generate) {
+            usage(argv[0]);
+          }
+          break;
+        case 'j':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-jobs")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &jobs) || !jobs) {
+            usage(argv[0]);
+          }
+          break;
+        case 'd':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-dimensions")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              sscanf(argv[i], "%hux%hu", &width, &height) != 2) {
+            usage(argv[0]);
+          }
+          break;
+        case 'c':
+          /* '--check', long only, has --headless make sure a batch's *
+           * last game plays the same as it does alone.               */
+          if (long_arg && !strcmp(argv[i], "-check")) {
+            check = 1;
+            break;
+          }
+          /* Distance maps cached, in kilobytes; zero turns it off. */
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-cache")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &d.path_cache_kb)) {
+            usage(argv[0]);
+          }
+          break;
+        case 'a':
+          /* Monsters plan their moves on this many threads; zero, the *
+           * default, has them decide one at a time instead.           */
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-ai-threads")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &d.ai_threads)) {
+            usage(argv[0]);
+          }
+          break;
         default:
           usage(argv[0]);
         }
@@ -197,6 +593,30 @@ int main(int argc, char *argv[])
     }
   }
 
+  if (replay_file) {
+    /* A replay is a one-game headless run with the recorded switches. *
+     * Anything else on the command line is ignored, except for the    *
+     * number of --ai-threads, which can't change the game.            */
+    replay_open(replay_file, &header);
+    seed = header.seed;
+    d.max_monsters = header.max_monsters;
+    d.max_objects = header.max_objects;
+    max_turns = header.max_turns;
+    width = header.width;
+    height = header.height;
+    do_load = header.do_load;
+    do_image = header.do_image;
+    load_file = pgm_file = header.file;
+    if (!header.parallel_ai) {
+      d.ai_threads = 0;
+    } else if (!d.ai_threads) {
+      d.ai_threads = jobs;
+    }
+    do_headless = games = 1;
+    do_seed = do_save = 0;
+    record_file = NULL;
+  }
+
   if (do_seed) {
     /* Allows me to generate more than one dungeon *
      * per second, as opposed to time().           */
@@ -204,7 +624,43 @@ int main(int argc, char *argv[])
     seed = (tv.tv_usec ^ (tv.tv_sec << 20)) & 0xffffffff;
   }
 
-  srand(seed);
+  if (generate) {
+    generate_dungeons(seed, generate, jobs, width, height);
+
+    return 0;
+  }
+
+  if (record_file) {
+    if (do_headless && games != 1) {
+      fprintf(stderr, "Can only record one game.\n");
+      exit(-1);
+    }
+    header.seed = seed;
+    header.max_monsters = d.max_monsters;
+    header.max_objects = d.max_objects;
+    header.max_turns = max_turns;
+    header.width = width;
+    header.height = height;
+    header.do_load = do_load;
+    header.do_image = do_image;
+    header.parallel_ai = d.ai_threads != 0;
+    header.file = do_load ? load_file : (do_image ? pgm_file : NULL);
+    replay_record(record_file, &header);
+  }
+
+  /* Loaded and PGM dungeons bring their own size; this is only the *
+   * size of a generated one.                                       */
+  resize_dungeon(&d, width, height);
+
+  if (do_headless) {
+    play_headless(&d, seed, games, max_turns,
+                  load_file, pgm_file, do_load, do_image, check);
+    replay_close();
+
+    return 0;
+  }
+
+  seed_dungeon(&d, seed);
 
   parse_descriptions(&d);
   io_init_terminal();
@@ -228,12 +684,16 @@ int main(int argc, char *argv[])
   if (!do_load && !do_image) {
     io_queue_message("Seed is %u.", seed);
   }
-  while (pc_is_alive(&d) && boss_is_alive(&d) && !d.quit) {
+  for (i = 0;
+       pc_is_alive(&d) && boss_is_alive(&d) && !d.quit &&
+         (!max_turns || (uint32_t) i < max_turns);
+       i++) {
     do_moves(&d);
   }
   io_display(&d);
 
   io_reset_terminal();
+  replay_close();
 
   if (do_save) {
     if (do_save_seed) {
@@ -0,0 +1,67 @@
+#ifndef RNG_H
+# define RNG_H
+
+# include <stdint.h>
+
+/* A PCG32 generator (O'Neill, "PCG: A Family of Simple Fast Space-    *
+ * Efficient Statistically Good Algorithms for Random Number           *
+ * Generation").  64 bits of LCG state, permuted down to 32 bits of    *
+ * output.  The increment selects one of 2^63 streams, so generators   *
+ * seeded with the same seed but different streams are independent.    *
+ *                                                                     *
+ * Unlike rand(), there's no hidden global state: every generator is   *
+ * an object, so two dungeons--or two threads--never share one, and    *
+ * one subsystem drawing more or fewer numbers doesn't change what any *
+ * other subsystem sees.                                               */
+class rng {
+ private:
+  uint64_t state, inc;
+ public:
+  rng()
+  {
+    seed(0, 0);
+  }
+  rng(uint64_t s, uint64_t stream)
+  {
+    seed(s, stream);
+  }
+  inline void seed(uint64_t s, uint64_t stream)
+  {
+    state = 0;
+    inc = (stream << 1) | 1;
+    next();
+    state += s;
+    next();
+  }
+  inline uint32_t next()
+  {
+    uint64_t old;
+    uint32_t xorshifted, rot;
+
+    old = state;
+    state = old * 6364136223846793005ULL + inc;
+    xorshifted = ((old >> 18) ^ old) >> 27;
+    rot = old >> 59;
+
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+  }
+  /* Returns random integer in [0, n).  Multiply and shift instead of *
+   * a modulus; the bias is at most n / 2^32, far less than rand() %  *
+   * n ever had.                                                      */
+  inline uint32_t under(uint32_t n)
+  {
+    return ((uint64_t) next() * n) >> 32;
+  }
+  /* Returns random integer in [min, max]. */
+  inline int32_t range(int32_t min, int32_t max)
+  {
+    return min + (int32_t) under(max + 1 - min);
+  }
+  /* Returns true with probability numerator/denominator. */
+  inline bool chance(uint32_t numerator, uint32_t denominator)
+  {
+    return under(denominator) < numerator;
+  }
+};
+
+#endif
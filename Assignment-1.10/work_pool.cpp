@@ -0,0 +1,122 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "work_pool.h"
+
+static void work(work_pool_t *p)
+{
+  uint32_t i;
+
+  while ((i = __atomic_fetch_add(&p->next_item, 1, __ATOMIC_RELAXED)) <
+         p->items) {
+    p->func(p->arg, i);
+  }
+}
+
+static void *work_pool_worker(void *v)
+{
+  work_pool_t *p = (work_pool_t *) v;
+  uint32_t job;
+
+  /* Not p->job: the first job may already have started. */
+  job = 0;
+  pthread_mutex_lock(&p->lock);
+  for (;;) {
+    while (!p->quit && p->job == job) {
+      pthread_cond_wait(&p->start, &p->lock);
+    }
+    if (p->quit) {
+      break;
+    }
+    job = p->job;
+    pthread_mutex_unlock(&p->lock);
+
+    work(p);
+
+    pthread_mutex_lock(&p->lock);
+    if (!--p->busy) {
+      pthread_cond_signal(&p->done);
+    }
+  }
+  pthread_mutex_unlock(&p->lock);
+
+  return NULL;
+}
+
+void work_pool_init(work_pool_t *p, uint32_t threads)
+{
+  uint32_t i;
+
+  p->num_threads = threads > 1 ? threads - 1 : 0;
+  p->threads = (pthread_t *) malloc(p->num_threads * sizeof (*p->threads));
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->start, NULL);
+  pthread_cond_init(&p->done, NULL);
+  p->job = 0;
+  p->quit = 0;
+  p->func = NULL;
+  p->arg = NULL;
+  p->items = 0;
+  p->next_item = 0;
+  p->busy = 0;
+
+  for (i = 0; i < p->num_threads; i++) {
+    if (pthread_create(p->threads + i, NULL, work_pool_worker, p)) {
+      perror("pthread_create");
+      exit(-1);
+    }
+  }
+}
+
+void work_pool_delete(work_pool_t *p)
+{
+  uint32_t i;
+
+  pthread_mutex_lock(&p->lock);
+  p->quit = 1;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+
+  for (i = 0; i < p->num_threads; i++) {
+    pthread_join(p->threads[i], NULL);
+  }
+
+  pthread_cond_destroy(&p->done);
+  pthread_cond_destroy(&p->start);
+  pthread_mutex_destroy(&p->lock);
+  free(p->threads);
+  p->threads = NULL;
+  p->num_threads = 0;
+}
+
+void work_pool_run(work_pool_t *p, uint32_t items,
+                   work_func_t func, void *arg)
+{
+  uint32_t i;
+
+  /* Waking the workers costs more than a single item is worth. */
+  if (!p->num_threads || items < 2) {
+    for (i = 0; i < items; i++) {
+      func(arg, i);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&p->lock);
+  p->func = func;
+  p->arg = arg;
+  p->items = items;
+  p->next_item = 0;
+  p->busy = p->num_threads;
+  p->job++;
+  pthread_cond_broadcast(&p->start);
+  pthread_mutex_unlock(&p->lock);
+
+  work(p);
+
+  pthread_mutex_lock(&p->lock);
+  while (p->busy) {
+    pthread_cond_wait(&p->done, &p->lock);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
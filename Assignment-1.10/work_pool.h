@@ -0,0 +1,41 @@
+#ifndef WORK_POOL_H
+# define WORK_POOL_H
+
+# include <stdint.h>
+# include <pthread.h>
+
+/* A fixed set of threads that run one job at a time: a function called *
+ * once for each of a number of items, which may run in any order and   *
+ * on any thread.  Items are handed out one at a time from a shared     *
+ * counter, so a thread that gets quick ones just takes more of them,   *
+ * and the thread that calls work_pool_run() takes its share, too.      *
+ * Nothing about a job's result may depend on which thread ran what;    *
+ * each item has to write only to a place of its own.                   */
+
+typedef void (*work_func_t)(void *arg, uint32_t item);
+
+typedef struct work_pool {
+  pthread_t *threads;
+  uint32_t num_threads;
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  /* Bumped for every job, so a worker knows a new one from the last. */
+  uint32_t job;
+  uint32_t quit;
+  work_func_t func;
+  void *arg;
+  uint32_t items;
+  uint32_t next_item;
+  /* Workers still on the current job. */
+  uint32_t busy;
+} work_pool_t;
+
+/* threads counts the caller's thread; 1 runs everything on the caller. */
+void work_pool_init(work_pool_t *p, uint32_t threads);
+void work_pool_delete(work_pool_t *p);
+/* Calls func(arg, i) for every i < items, and returns once all have. */
+void work_pool_run(work_pool_t *p, uint32_t items,
+                   work_func_t func, void *arg);
+
+#endif